@@ -0,0 +1,225 @@
+// alog.h
+// Log asíncrono para server.c: los hilos que atienden conexiones solo formatean el
+// registro en un anillo acotado (MPSC, cola de Vyukov con número de secuencia por hueco)
+// y un hilo escritor los vuelca en lotes con writev().
+// - Política con el anillo lleno: ALOG_DROP descarta y cuenta, ALOG_BLOCK espera hueco.
+// - alog_now() cachea por hilo la marca "YYYY-mm-dd HH:MM:SS" y solo la rehace al cambiar el segundo.
+// - En modo fork, el hijo llama a alog_after_fork() para tener su propio escritor.
+
+#ifndef ALOG_H
+#define ALOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define ALOG_SLOTS 1024            // potencia de 2
+#define ALOG_REC   4608            // cabe una línea de chat completa con su prefijo
+#define ALOG_BATCH 64              // iovecs por writev()
+
+enum { ALOG_DROP, ALOG_BLOCK };
+
+typedef struct {
+    atomic_size_t seq;
+    size_t len;
+    char text[ALOG_REC];
+} alog_slot;
+
+static struct {
+    alog_slot ring[ALOG_SLOTS];
+    atomic_size_t head;            // siguiente posición a reservar (productores)
+    size_t tail;                   // siguiente posición a volcar (solo el escritor)
+    int fd;
+    int policy;
+    bool running;
+    atomic_ullong dropped;
+    atomic_int writer_idle, waiters;
+    pthread_mutex_t mu;            // esperas de escritor y productores
+    pthread_mutex_t drain_mu;      // un solo volcador a la vez (escritor o atexit)
+    pthread_cond_t data_cv, space_cv;
+    pthread_t th;
+} alog_q = { .fd = -1, .mu = PTHREAD_MUTEX_INITIALIZER, .drain_mu = PTHREAD_MUTEX_INITIALIZER,
+             .data_cv = PTHREAD_COND_INITIALIZER, .space_cv = PTHREAD_COND_INITIALIZER };
+
+static inline const char *alog_now(void) {
+    static __thread time_t cached_sec = -1;
+    static __thread char cached[32];
+    time_t t = time(NULL);
+    if (t != cached_sec) {
+        struct tm tm; localtime_r(&t, &tm);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_sec = t;
+    }
+    return cached;
+}
+
+static inline unsigned long long alog_dropped(void) {
+    return atomic_load_explicit(&alog_q.dropped, memory_order_relaxed);
+}
+
+static inline void alog_timed_wait(pthread_cond_t *cv) {
+    struct timespec ts; clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 10 * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+    pthread_cond_timedwait(cv, &alog_q.mu, &ts);
+}
+
+static inline void alog_write_all(struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t w = writev(alog_q.fd, iov, cnt);
+        if (w < 0) { if (errno == EINTR) continue; return; }
+        while (cnt > 0 && (size_t)w >= iov->iov_len) { w -= (ssize_t)iov->iov_len; iov++; cnt--; }
+        if (cnt > 0) { iov->iov_base = (char*)iov->iov_base + w; iov->iov_len -= (size_t)w; }
+    }
+}
+
+static inline bool alog_ready(void) {
+    alog_slot *s = &alog_q.ring[alog_q.tail & (ALOG_SLOTS - 1)];
+    return atomic_load_explicit(&s->seq, memory_order_acquire) == alog_q.tail + 1;
+}
+
+// Vuelca hasta ALOG_BATCH registros listos (con drain_mu tomado). Devuelve cuántos.
+static inline int alog_drain_batch(void) {
+    struct iovec iov[ALOG_BATCH];
+    int cnt = 0;
+    size_t pos = alog_q.tail;
+    while (cnt < ALOG_BATCH) {
+        alog_slot *s = &alog_q.ring[(pos + (size_t)cnt) & (ALOG_SLOTS - 1)];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != pos + (size_t)cnt + 1) break;
+        iov[cnt].iov_base = s->text; iov[cnt].iov_len = s->len;
+        cnt++;
+    }
+    if (cnt == 0) return 0;
+    alog_write_all(iov, cnt);
+    for (int i = 0; i < cnt; i++) {
+        alog_slot *s = &alog_q.ring[(pos + (size_t)i) & (ALOG_SLOTS - 1)];
+        atomic_store_explicit(&s->seq, pos + (size_t)i + ALOG_SLOTS, memory_order_release);
+    }
+    alog_q.tail = pos + (size_t)cnt;
+    if (atomic_load_explicit(&alog_q.waiters, memory_order_acquire) > 0) {
+        pthread_mutex_lock(&alog_q.mu);
+        pthread_cond_broadcast(&alog_q.space_cv);
+        pthread_mutex_unlock(&alog_q.mu);
+    }
+    return cnt;
+}
+
+static inline void *alog_writer(void *arg) {
+    (void)arg;
+    unsigned long long reported = 0;
+    for (;;) {
+        pthread_mutex_lock(&alog_q.drain_mu);
+        int n = alog_drain_batch();
+        pthread_mutex_unlock(&alog_q.drain_mu);
+        if (n > 0) continue;
+        unsigned long long d = alog_dropped();
+        if (d != reported) {
+            char msg[96];
+            int len = snprintf(msg, sizeof(msg), "[LOG] %llu registros descartados (anillo lleno)\n", d - reported);
+            struct iovec v = { msg, (size_t)len };
+            alog_write_all(&v, 1);
+            reported = d;
+        }
+        // Sin datos: dormir hasta que un productor avise (o 10 ms, por si se perdió el aviso)
+        pthread_mutex_lock(&alog_q.mu);
+        atomic_store(&alog_q.writer_idle, 1);
+        if (!alog_ready()) alog_timed_wait(&alog_q.data_cv);
+        atomic_store(&alog_q.writer_idle, 0);
+        pthread_mutex_unlock(&alog_q.mu);
+    }
+    return NULL;
+}
+
+static inline void alog_reset(void) {
+    for (size_t i = 0; i < ALOG_SLOTS; i++) atomic_init(&alog_q.ring[i].seq, i);
+    atomic_init(&alog_q.head, 0);
+    alog_q.tail = 0;
+    atomic_init(&alog_q.writer_idle, 0);
+    atomic_init(&alog_q.waiters, 0);
+}
+
+// Vacía lo pendiente de forma síncrona (atexit). Los registros aún a medio escribir se pierden.
+static inline void alog_flush_at_exit(void) {
+    if (!alog_q.running) return;
+    pthread_mutex_lock(&alog_q.drain_mu);
+    while (alog_drain_batch() > 0) {}
+    pthread_mutex_unlock(&alog_q.drain_mu);
+}
+
+static inline void alog_start(int fd, int policy) {
+    alog_q.fd = fd;
+    alog_q.policy = policy;
+    alog_reset();
+    if (pthread_create(&alog_q.th, NULL, alog_writer, NULL) != 0) { perror("pthread_create"); return; }
+    pthread_detach(alog_q.th);
+    if (!alog_q.running) atexit(alog_flush_at_exit);
+    alog_q.running = true;
+}
+
+// El hijo de fork() hereda el anillo pero no el hilo escritor: se reinicia vacío.
+static inline void alog_after_fork(void) {
+    if (!alog_q.running) return;
+    pthread_mutex_init(&alog_q.mu, NULL);
+    pthread_mutex_init(&alog_q.drain_mu, NULL);
+    pthread_cond_init(&alog_q.data_cv, NULL);
+    pthread_cond_init(&alog_q.space_cv, NULL);
+    atomic_init(&alog_q.dropped, 0);
+    alog_reset();
+    if (pthread_create(&alog_q.th, NULL, alog_writer, NULL) != 0) { perror("pthread_create"); alog_q.running = false; return; }
+    pthread_detach(alog_q.th);
+}
+
+__attribute__((format(printf, 1, 2)))
+static inline void alog(const char *fmt, ...) {
+    va_list ap;
+    if (!alog_q.running) {          // antes de alog_start(): salida directa
+        va_start(ap, fmt); vprintf(fmt, ap); va_end(ap);
+        fflush(stdout);
+        return;
+    }
+    alog_slot *s;
+    size_t pos = atomic_load_explicit(&alog_q.head, memory_order_relaxed);
+    for (;;) {
+        s = &alog_q.ring[pos & (ALOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&alog_q.head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {      // lleno
+            if (alog_q.policy == ALOG_DROP) {
+                atomic_fetch_add_explicit(&alog_q.dropped, 1, memory_order_relaxed);
+                return;
+            }
+            pthread_mutex_lock(&alog_q.mu);
+            atomic_fetch_add(&alog_q.waiters, 1);
+            alog_timed_wait(&alog_q.space_cv);
+            atomic_fetch_sub(&alog_q.waiters, 1);
+            pthread_mutex_unlock(&alog_q.mu);
+            pos = atomic_load_explicit(&alog_q.head, memory_order_relaxed);
+        } else {
+            pos = atomic_load_explicit(&alog_q.head, memory_order_relaxed);
+        }
+    }
+    va_start(ap, fmt);
+    int n = vsnprintf(s->text, sizeof(s->text), fmt, ap);
+    va_end(ap);
+    s->len = (n < 0) ? 0 : ((size_t)n >= sizeof(s->text) ? sizeof(s->text) - 1 : (size_t)n);
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+    if (atomic_load_explicit(&alog_q.writer_idle, memory_order_acquire)) {
+        pthread_mutex_lock(&alog_q.mu);
+        pthread_cond_signal(&alog_q.data_cv);
+        pthread_mutex_unlock(&alog_q.mu);
+    }
+}
+
+#endif
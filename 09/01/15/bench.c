@@ -0,0 +1,347 @@
+// bench.c
+// Generador de carga para server.c con el mismo protocolo que client.c:
+// abre N sesiones concurrentes, se autentica con usuarios de users.csv y envía una mezcla
+// de líneas de chat y FILE a un ritmo objetivo. Informa de throughput, latencia de
+// conexión/AUTH y p50/p99/p999 del eco del chat.
+// - Con -r la carga es abierta: cada operación tiene una hora programada y la latencia se
+//   mide desde esa hora, así un servidor atascado no esconde su cola (coordinated omission).
+// - Con -B cada sesión negocia el modo binario (frame.h) tras AUTH_OK.
+// - Con -U ruta conecta por el socket AF_UNIX del servidor (server --unix) en lugar de TCP:
+//   la misma carga contra los dos transportes compara conexión, AUTH y eco.
+//
+// Compilar: gcc -O2 -Wall -pthread bench.c -o bench
+// Ejemplo:  ./bench -c 200 -d 10 -r 20000 -f 0.05 -s 4K,1M
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "rbuf.h"
+#include "hist.h"
+#include "frame.h"
+
+#define BUFFER_SIZE 4096
+#define MAX_SIZES 16
+
+typedef struct { char user[256]; char pass[256]; } cred;
+
+static struct {
+    const char *host;
+    int port;
+    int sessions;
+    int duration;
+    double rate;            // operaciones/s en total; 0 = lo más rápido posible
+    double file_frac;       // fracción de operaciones que son FILE
+    long long sizes[MAX_SIZES];
+    int nsizes;
+    int msg_len;
+    const char *csv;
+    bool binary;
+    const char *unix_path;  // -U: AF_UNIX en vez de TCP
+} cfg = { "127.0.0.1", 8080, 10, 10, 0.0, 0.0, { 64 * 1024 }, 1, 32, "users.csv", false, NULL };
+
+static cred *creds = NULL;
+static int ncreds = 0;
+static char *payload = NULL;     // contenido de los FILE (patrón de texto)
+
+static hist h_connect, h_auth, h_echo, h_file;
+static atomic_ullong n_msgs, n_files, bytes_up, n_fail_conn, n_fail_auth, n_errors;
+static pthread_barrier_t start_barrier;
+static struct timespec t_start;
+
+static uint64_t ts_ns(const struct timespec *t) { return (uint64_t)t->tv_sec * 1000000000ULL + (uint64_t)t->tv_nsec; }
+static uint64_t now_ns(void) { struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return ts_ns(&t); }
+static void sleep_until(uint64_t ns) {
+    struct timespec t = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {}
+}
+
+static void rstrip_newline(char *s) {
+    size_t n = strlen(s);
+    while (n > 0 && (s[n-1] == '\n' || s[n-1] == '\r')) s[--n] = '\0';
+}
+static void trim(char *s) {
+    char *p = s, *q = s + strlen(s) - 1;
+    while (*p && isspace((unsigned char)*p)) p++;
+    while (q >= p && isspace((unsigned char)*q)) *q-- = '\0';
+    if (p != s) memmove(s, p, (size_t)(q - p + 2));
+}
+static int load_creds(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        char *p = strchr(line, ','); if (!p) continue;
+        *p = '\0';
+        char *pass = p + 1;
+        rstrip_newline(pass);
+        char *role = strchr(pass, ','); if (role) *role = '\0';
+        trim(line); trim(pass);
+        cred *n = (cred*)realloc(creds, sizeof(cred) * (size_t)(ncreds + 1));
+        if (!n) break;
+        creds = n;
+        snprintf(creds[ncreds].user, sizeof(creds[ncreds].user), "%.255s", line);
+        snprintf(creds[ncreds].pass, sizeof(creds[ncreds].pass), "%.255s", pass);
+        ncreds++;
+    }
+    fclose(f);
+    return ncreds > 0 ? 0 : -1;
+}
+static long long parse_size(const char *s) {
+    char *end; double v = strtod(s, &end);
+    switch (toupper((unsigned char)*end)) {
+    case 'K': v *= 1024; break;
+    case 'M': v *= 1024 * 1024; break;
+    case 'G': v *= 1024.0 * 1024 * 1024; break;
+    }
+    return (long long)v;
+}
+
+static int send_all(int sock, const void *buf, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t w = send(sock, (const char*)buf + sent, len - sent, MSG_NOSIGNAL);
+        if (w < 0) { if (errno == EINTR) continue; return -1; }
+        sent += (size_t)w;
+    }
+    return 0;
+}
+// Espera una línea que empiece por prefix (ignora las demás, p. ej. mensajes de otros).
+static int wait_line(rbuf *in, int sock, const char *prefix, char *line, size_t maxlen) {
+    size_t plen = strlen(prefix);
+    for (;;) {
+        ssize_t n = rbuf_read_line(in, sock, line, maxlen);
+        if (n <= 0) return -1;
+        if (strncmp(line, prefix, plen) == 0) return 0;
+    }
+}
+// Igual sobre tramas (modo binario): el eco llega en FR_MSG y las respuestas en FR_REPLY.
+static int wait_frame(rbuf *in, int sock, const char *prefix, char *line, size_t maxlen) {
+    size_t plen = strlen(prefix);
+    for (;;) {
+        unsigned char h[FRAME_HDR];
+        if (rbuf_read_n(in, sock, h, sizeof(h)) <= 0) return -1;
+        uint32_t len = frame_len(h);
+        if (len >= maxlen) return -1;
+        if (len > 0 && rbuf_read_n(in, sock, line, len) <= 0) return -1;
+        line[len] = '\0';
+        if (strncmp(line, prefix, plen) == 0) return 0;
+    }
+}
+static int wait_reply(rbuf *in, int sock, const char *prefix, char *line, size_t maxlen) {
+    return cfg.binary ? wait_frame(in, sock, prefix, line, maxlen) : wait_line(in, sock, prefix, line, maxlen);
+}
+
+static int connect_server(void) {
+    if (cfg.unix_path) {
+        struct sockaddr_un a; memset(&a, 0, sizeof(a));
+        a.sun_family = AF_UNIX;
+        snprintf(a.sun_path, sizeof(a.sun_path), "%s", cfg.unix_path);
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0) return -1;
+        if (connect(sock, (struct sockaddr*)&a, sizeof(a)) < 0) { close(sock); return -1; }
+        return sock;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    struct sockaddr_in a; memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET; a.sin_port = htons((uint16_t)cfg.port);
+    if (inet_pton(AF_INET, cfg.host, &a.sin_addr) <= 0 ||
+        connect(sock, (struct sockaddr*)&a, sizeof(a)) < 0) { close(sock); return -1; }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+// Dos fases: todas conectadas y autenticadas -> main fija t_start -> arrancan juntas.
+static void sync_start(void) {
+    pthread_barrier_wait(&start_barrier);
+    pthread_barrier_wait(&start_barrier);
+}
+
+typedef struct { int id; unsigned seed; } session_arg;
+
+static void *session_thread(void *arg) {
+    session_arg *sa = (session_arg*)arg;
+    char in_mem[BUFFER_SIZE + 1]; rbuf in; rbuf_init(&in, in_mem, sizeof(in_mem));
+    char line[BUFFER_SIZE + 64];
+    const cred *cr = &creds[sa->id % ncreds];
+
+    uint64_t t0 = now_ns();
+    int sock = connect_server();
+    if (sock < 0) { atomic_fetch_add(&n_fail_conn, 1); sync_start(); return NULL; }
+    uint64_t t1 = now_ns();
+    hist_record(&h_connect, t1 - t0);
+
+    snprintf(line, sizeof(line), "AUTH %s %s\n", cr->user, cr->pass);
+    if (send_all(sock, line, strlen(line)) != 0 || rbuf_read_line(&in, sock, line, sizeof(line)) <= 0 ||
+        strncmp(line, "AUTH_OK", 7) != 0) {
+        atomic_fetch_add(&n_fail_auth, 1); close(sock); sync_start(); return NULL;
+    }
+    hist_record(&h_auth, now_ns() - t1);
+    if (cfg.binary && (send_all(sock, "BINARY\n", 7) != 0 || rbuf_read_line(&in, sock, line, sizeof(line)) <= 0 ||
+                       strncmp(line, "BINARY_OK", 9) != 0)) {
+        atomic_fetch_add(&n_fail_auth, 1); close(sock); sync_start(); return NULL;
+    }
+
+    sync_start();
+    uint64_t start = ts_ns(&t_start), end = start + (uint64_t)cfg.duration * 1000000000ULL;
+    // Reparto del ritmo total entre sesiones, desfasadas para no disparar todas a la vez
+    uint64_t interval = cfg.rate > 0 ? (uint64_t)(1e9 * cfg.sessions / cfg.rate) : 0;
+    uint64_t next = start + (interval ? interval * (uint64_t)sa->id / (uint64_t)cfg.sessions : 0);
+    unsigned long seq = 0;
+    char msg[BUFFER_SIZE];
+
+    while (1) {
+        if (interval) sleep_until(next);
+        uint64_t sched = interval ? next : now_ns();
+        if (sched >= end) break;
+        bool is_file = cfg.file_frac > 0 && (double)rand_r(&sa->seed) / RAND_MAX < cfg.file_frac;
+        if (is_file) {
+            long long sz = cfg.sizes[seq % (unsigned long)cfg.nsizes];
+            int hl;
+            if (cfg.binary) {
+                int nl = snprintf(msg + FRAME_HDR + 8, sizeof(msg) - FRAME_HDR - 8, "bench_%d.txt", sa->id);
+                frame_put_hdr((unsigned char*)msg, FR_FILE, (uint32_t)(8 + nl));
+                frame_put_u64((unsigned char*)msg + FRAME_HDR, (uint64_t)sz);
+                hl = FRAME_HDR + 8 + nl;
+            } else {
+                hl = snprintf(msg, sizeof(msg), "FILE bench_%d.txt %lld\n", sa->id, sz);
+            }
+            if (send_all(sock, msg, (size_t)hl) != 0 || send_all(sock, payload, (size_t)sz) != 0 ||
+                wait_reply(&in, sock, "FILE_", line, sizeof(line)) != 0) break;
+            if (strncmp(line, "FILE_OK", 7) != 0) atomic_fetch_add(&n_errors, 1);
+            hist_record(&h_file, now_ns() - sched);
+            atomic_fetch_add(&n_files, 1);
+            atomic_fetch_add(&bytes_up, (unsigned long long)sz);
+        } else {
+            int off = cfg.binary ? FRAME_HDR : 0;
+            int ml = off + snprintf(msg + off, sizeof(msg) - (size_t)off, "bench %d %lu ", sa->id, seq);
+            while (ml - off < cfg.msg_len && ml < (int)sizeof(msg) - 2) msg[ml++] = 'x';
+            if (cfg.binary) frame_put_hdr((unsigned char*)msg, FR_MSG, (uint32_t)(ml - off));
+            else msg[ml++] = '\n';
+            if (send_all(sock, msg, (size_t)ml) != 0 || wait_reply(&in, sock, "SERVIDOR: ", line, sizeof(line)) != 0) break;
+            hist_record(&h_echo, now_ns() - sched);
+            atomic_fetch_add(&n_msgs, 1);
+        }
+        seq++;
+        if (interval) next += interval;
+        else if (now_ns() >= end) break;
+    }
+    if (cfg.binary) {
+        unsigned char bye[FRAME_HDR + 5];
+        frame_put_hdr(bye, FR_CMD, 5); memcpy(bye + FRAME_HDR, "salir", 5);
+        send_all(sock, bye, sizeof(bye));
+    } else {
+        send_all(sock, "salir\n", 6);
+    }
+    close(sock);
+    return NULL;
+}
+
+static void print_hist(const char *name, hist *h, double div, const char *unit) {
+    printf("  %-10s n=%-8llu p50=%9.1f p99=%9.1f p999=%9.1f max=%9.1f %s\n", name,
+           atomic_load(&h->count), (double)hist_percentile(h, 50) / div, (double)hist_percentile(h, 99) / div,
+           (double)hist_percentile(h, 99.9) / div, (double)atomic_load(&h->max) / div, unit);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Uso: %s [-H host] [-p puerto] [-c sesiones] [-d segundos] [-r ops/s] [-f fracción_FILE]\n"
+        "          [-s tam[,tam...]] [-l largo_mensaje] [-u users.csv] [-B] [-U ruta]\n"
+        "  -r 0 (por defecto): cada sesión manda en cuanto recibe la respuesta anterior\n"
+        "  -s admite sufijos K/M/G; con varios tamaños se alternan\n"
+        "  -B usa el modo binario (tramas tipo + longitud) en lugar de líneas de texto\n"
+        "  -U conecta al socket AF_UNIX ruta (server --unix) en lugar de host:puerto\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int o;
+    while ((o = getopt(argc, argv, "H:p:c:d:r:f:s:l:u:BU:h")) != -1) {
+        switch (o) {
+        case 'H': cfg.host = optarg; break;
+        case 'p': cfg.port = atoi(optarg); break;
+        case 'c': cfg.sessions = atoi(optarg); break;
+        case 'd': cfg.duration = atoi(optarg); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'f': cfg.file_frac = atof(optarg); break;
+        case 'l': cfg.msg_len = atoi(optarg); break;
+        case 'u': cfg.csv = optarg; break;
+        case 'B': cfg.binary = true; break;
+        case 'U': cfg.unix_path = optarg; break;
+        case 's': {
+            cfg.nsizes = 0;
+            char *save = NULL;
+            for (char *t = strtok_r(optarg, ",", &save); t && cfg.nsizes < MAX_SIZES; t = strtok_r(NULL, ",", &save))
+                cfg.sizes[cfg.nsizes++] = parse_size(t);
+            break;
+        }
+        default: usage(argv[0]); return o == 'h' ? 0 : 1;
+        }
+    }
+    if (cfg.sessions <= 0 || cfg.duration <= 0 || cfg.nsizes == 0 || cfg.msg_len >= BUFFER_SIZE - 2 ||
+        (cfg.binary && cfg.msg_len > FRAME_MAX)) { usage(argv[0]); return 1; }
+    if (load_creds(cfg.csv) != 0) { fprintf(stderr, "Sin usuarios en %s\n", cfg.csv); return 1; }
+    signal(SIGPIPE, SIG_IGN);
+
+    long long maxsz = 0;
+    for (int i = 0; i < cfg.nsizes; i++) if (cfg.sizes[i] > maxsz) maxsz = cfg.sizes[i];
+    if (cfg.file_frac > 0) {
+        payload = (char*)malloc((size_t)maxsz + 1);
+        if (!payload) { perror("malloc"); return 1; }
+        for (long long i = 0; i < maxsz; i++) payload[i] = (i % 64 == 63) ? '\n' : (char)('a' + i % 26);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)cfg.sessions + 1);
+    pthread_attr_t attr; pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    pthread_t *th = (pthread_t*)calloc((size_t)cfg.sessions, sizeof(pthread_t));
+    session_arg *args = (session_arg*)calloc((size_t)cfg.sessions, sizeof(session_arg));
+    if (!th || !args) { perror("calloc"); return 1; }
+
+    if (cfg.unix_path) printf("Conectando %d sesiones a %s (AF_UNIX, modo %s)...\n", cfg.sessions, cfg.unix_path, cfg.binary ? "binario" : "texto");
+    else printf("Conectando %d sesiones a %s:%d (modo %s)...\n", cfg.sessions, cfg.host, cfg.port, cfg.binary ? "binario" : "texto");
+    uint64_t c0 = now_ns();
+    for (int i = 0; i < cfg.sessions; i++) {
+        args[i].id = i; args[i].seed = (unsigned)i * 2654435761u;
+        if (pthread_create(&th[i], &attr, session_thread, &args[i]) != 0) { perror("pthread_create"); return 1; }
+    }
+    pthread_barrier_wait(&start_barrier);    // todas conectadas (o fallidas)
+    double setup = (double)(now_ns() - c0) / 1e9;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    // El arranque efectivo es un poco después para que todas vean la misma hora de inicio
+    t_start.tv_nsec += 10 * 1000000L;
+    if (t_start.tv_nsec >= 1000000000L) { t_start.tv_sec++; t_start.tv_nsec -= 1000000000L; }
+    pthread_barrier_wait(&start_barrier);
+    for (int i = 0; i < cfg.sessions; i++) pthread_join(th[i], NULL);
+    double secs = (double)(now_ns() - ts_ns(&t_start)) / 1e9;
+
+    unsigned long long msgs = atomic_load(&n_msgs), files = atomic_load(&n_files), up = atomic_load(&bytes_up);
+    printf("\nSesiones: %d (fallo conexión %llu, fallo AUTH %llu), arranque %.2f s, medición %.2f s\n",
+           cfg.sessions, atomic_load(&n_fail_conn), atomic_load(&n_fail_auth), setup, secs);
+    printf("Throughput: %.0f mensajes/s, %.1f FILE/s, %.1f MB/s subidos (FILE_ERR: %llu)\n",
+           (double)msgs / secs, (double)files / secs, (double)up / secs / 1e6, atomic_load(&n_errors));
+    printf("Latencias:\n");
+    print_hist("conexión", &h_connect, 1000.0, "us");
+    print_hist("AUTH", &h_auth, 1000.0, "us");
+    print_hist("eco chat", &h_echo, 1000.0, "us");
+    print_hist("FILE", &h_file, 1e6, "ms");
+    return 0;
+}
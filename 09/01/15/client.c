@@ -3,7 +3,32 @@
 // Comandos:
 //  - Escribe mensajes y Enter para enviarlos.
 //  - 'salir' para terminar.
-//  - '/enviar <ruta>' para mandar archivo al servidor.
+//  - '/enviar <ruta>' para mandar archivo al servidor (con sendfile(); --no-zerocopy usa read + send).
+//  - '/enviarp <n> <ruta>' subida reanudable por rangos sobre n conexiones paralelas; si se
+//    corta, repetir el mismo comando envía solo lo que le falta al servidor.
+//  - '/enviarlote <ventana> <directorio|patrón>' sube muchos archivos seguidos sin esperar
+//    cada FILE_OK: hasta <ventana> archivos enviados sin confirmar. Informa de archivos/s y
+//    MB/s. Usa FILE/FILEZ y el CRC (--crc) como /enviar, pero sin --dedup (HAVE espera
+//    respuesta).
+//  - --compress: si el servidor acepta "COMPRESS lz", /enviar manda FILEZ comprimiendo por
+//    bloques (lz.h) mientras lee el archivo; informa del ratio y del throughput efectivo.
+//  - --crc: /enviar calcula antes el CRC32C del archivo (crc32c.h) y lo manda en la cabecera;
+//    el servidor lo comprueba sobre lo que recibe y lo devuelve en FILE_OK. Sin él (por
+//    defecto) el servidor puede recibir con splice().
+//  - --dedup: antes de enviar ofrece el SHA-256 ("HAVE"); si el servidor ya tiene ese
+//    contenido (--dedup en el servidor) responde FILE_OK ... dedup y no se manda nada.
+//  - '/bajar <nombre> [offset len]' descarga de uploads/ del servidor (GET) a ./descargas/;
+//    con offset/len solo ese rango, escrito en su sitio. El contenido va socket -> pipe ->
+//    fichero con splice() (--no-zerocopy: recv + pwrite).
+//  - 'JOIN <sala>', 'LEAVE', 'ROOMS': salas de chat (servidor en -m epoll); dentro de una
+//    sala los mensajes llegan a todos sus miembros como "[sala] usuario: texto".
+//  - --unix RUTA: conecta por el socket AF_UNIX del servidor (server --unix) en vez de TCP
+//    a 127.0.0.1; el protocolo es el mismo. También para las conexiones extra de /enviarp.
+//  - --binary: tras el login negocia tramas tipo + longitud (frame.h) en vez de líneas;
+//    los mensajes pueden llevar cualquier byte. /enviarp usa siempre texto.
+//  - '/enviara <usuario> <ruta>' manda el archivo directamente a otro usuario conectado
+//    (SENDTO; servidor en -m epoll o uring), sin que se guarde en el servidor. Lo que otros
+//    nos envían así ("RELAY <de> <nombre> <bytes>") se guarda en ./descargas/.
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -12,38 +37,59 @@
 #include <strings.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <signal.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <time.h>
+#include <glob.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+
+#include "rbuf.h"
+#include "frame.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "sha256.h"
 
 #define SERVER_IP "127.0.0.1"
 #define PORT 8080
 #define BUFFER_SIZE 4096
+#define DOWNLOAD_DIR "descargas"
+#define SPLICE_CHUNK (1 << 20)
 
 static volatile int running = 1;
+static char g_user[256], g_pass[256];   // para abrir conexiones extra (/enviarp)
+static int zerocopy = 1;           // --no-zerocopy: enviar con read + send
+static int binary = 0;             // --binary: conexión principal en tramas (frame.h)
+static int compress_on = 0;        // --compress (y el servidor lo aceptó): FILEZ en vez de FILE
+static int crc_on = 0;             // --crc: CRC32C en la cabecera de FILE/FILEZ
+static int dedup_on = 0;           // --dedup: ofrecer el SHA-256 antes de enviar
+static const char *unix_path = NULL;   // --unix: socket AF_UNIX del servidor
+
+// Un solo lector del socket (reader_thread); send_file() espera su FILE_OK/FILE_ERR
+// a través de este contador en lugar de competir por los bytes con recv().
+static pthread_mutex_t ack_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ack_cv = PTHREAD_COND_INITIALIZER;
+static long file_acks = 0;
+static long file_errs = 0;         // de ellas, FILE_ERR
+static volatile int acks_quiet = 0;    // /enviarlote: no imprimir cada FILE_OK
+static long have_no = 0;           // respuestas HAVE_NO (hay que enviar el contenido)
+static long gets_pending = 0;      // GET enviados sin GET_OK (ya descargado) ni GET_ERR
 
-typedef struct { int sock; } io_ctx;
+typedef struct {
+    int sock;
+    rbuf in;
+    char in_mem[BUFFER_SIZE + 1];
+} io_ctx;
 
 static void rstrip_newline(char *s) {
     size_t n = strlen(s);
     while (n > 0 && (s[n-1] == '\n' || s[n-1] == '\r')) s[--n] = '\0';
 }
-static ssize_t read_line(int fd, char *buf, size_t maxlen) {
-    size_t i = 0;
-    while (i < maxlen - 1) {
-        char c;
-        ssize_t r = recv(fd, &c, 1, 0);
-        if (r == 0) { if (i == 0) return 0; break; }
-        if (r < 0) { if (errno == EINTR) continue; return -1; }
-        buf[i++] = c;
-        if (c == '\n') break;
-    }
-    buf[i] = '\0';
-    return (ssize_t)i;
-}
 static long long file_size(const char *path) {
     struct stat st; return (stat(path, &st) == 0) ? (long long)st.st_size : -1;
 }
@@ -55,83 +101,656 @@ static const char *basename_simple(const char *p) {
 #endif
     return b ? b + 1 : p;
 }
+// Manda size bytes de fd por el socket: sendfile() (fichero -> socket dentro del kernel)
+// y, si no está disponible o se pidió --no-zerocopy, el bucle pread + send de siempre.
+static int send_payload(int sock, int fd, off_t start, long long size, int *used_sendfile) {
+    off_t off = start, end = start + size;
+    while (zerocopy && off < end) {
+        size_t want = (end - off > (1 << 30)) ? (1 << 30) : (size_t)(end - off);
+        ssize_t w = sendfile(sock, fd, &off, want);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EINVAL || errno == ENOSYS) && off == start) break;
+        if (w < 0) { perror("sendfile"); return -1; }
+        if (w == 0) break;
+        *used_sendfile = 1;
+    }
+    char buf[BUFFER_SIZE];
+    while (off < end) {
+        ssize_t r = pread(fd, buf, (end - off > (long long)sizeof(buf)) ? sizeof(buf) : (size_t)(end - off), off);
+        if (r < 0) { if (errno == EINTR) continue; perror("read"); return -1; }
+        if (r == 0) break;
+        ssize_t sent = 0;
+        while (sent < r) {
+            ssize_t w = send(sock, buf + sent, (size_t)(r - sent), 0);
+            if (w < 0) { if (errno == EINTR) continue; perror("send"); return -1; }
+            sent += w;
+        }
+        off += r;
+    }
+    // El fichero encogió mientras se enviaba: no se puede cumplir la cabecera
+    if (off < end) { fprintf(stderr, "Archivo truncado durante el envío\n"); return -1; }
+    return 0;
+}
+// FILEZ: lee de fd por bloques de LZ_BLOCK, comprime cada uno y lo envía con su cabecera
+// (o tal cual si no reduce). *wire acumula los bytes puestos en el cable.
+static int send_payload_z(int sock, int fd, long long size, long long *wire) {
+    static unsigned char in[LZ_BLOCK], out[LZ_HDR + LZ_BOUND(LZ_BLOCK)];
+    off_t off = 0;
+    while (off < size) {
+        size_t want = (size - off > LZ_BLOCK) ? LZ_BLOCK : (size_t)(size - off), got = 0;
+        while (got < want) {
+            ssize_t r = pread(fd, in + got, want - got, off + (off_t)got);
+            if (r < 0) { if (errno == EINTR) continue; perror("read"); return -1; }
+            if (r == 0) { fprintf(stderr, "Archivo truncado durante el envío\n"); return -1; }
+            got += (size_t)r;
+        }
+        size_t clen = lz_compress(in, want, out + LZ_HDR);
+        if (clen >= want) {                      // no compensa: bloque sin comprimir
+            memcpy(out + LZ_HDR, in, want);
+            clen = want;
+            lz_put_hdr(out, (uint32_t)want | LZ_STORED, (uint32_t)want);
+        } else {
+            lz_put_hdr(out, (uint32_t)clen, (uint32_t)want);
+        }
+        size_t n = LZ_HDR + clen, sent = 0;
+        while (sent < n) {
+            ssize_t w = send(sock, out + sent, n - sent, 0);
+            if (w < 0) { if (errno == EINTR) continue; perror("send"); return -1; }
+            sent += (size_t)w;
+        }
+        *wire += (long long)n;
+        off += (off_t)want;
+    }
+    return 0;
+}
+// Trama completa (cabecera + carga) en un solo send().
+static int send_frame(int sock, int type, const void *data, size_t len) {
+    unsigned char buf[FRAME_HDR + FRAME_MAX];
+    if (len > FRAME_MAX) { errno = EMSGSIZE; return -1; }
+    frame_put_hdr(buf, type, (uint32_t)len);
+    memcpy(buf + FRAME_HDR, data, len);
+    return send(sock, buf, FRAME_HDR + len, 0) == (ssize_t)(FRAME_HDR + len) ? 0 : -1;
+}
+// Lo escrito empieza por una orden que el servidor atiende como comando (en texto, la misma
+// línea): en binario va en FR_CMD y el servidor decide como con el texto; lo demás, FR_MSG.
+static int is_command(const char *input) {
+    static const char *verbs[] = { "STATS", "WHO", "JOIN", "LEAVE", "ROOMS" };
+    size_t n = strcspn(input, " ");
+    for (size_t i = 0; i < sizeof(verbs) / sizeof(verbs[0]); i++)
+        if (strlen(verbs[i]) == n && strncasecmp(input, verbs[i], n) == 0) return 1;
+    return 0;
+}
+// CRC32C (y SHA-256 si sha_hex) del archivo entero, en una sola pasada previa:
+// la cabecera va antes que el contenido.
+static int file_digest(int fd, long long size, uint32_t *crc, char *sha_hex) {
+    static unsigned char buf[1 << 20];
+    uint32_t c = 0;
+    sha256_ctx sha; sha256_init(&sha);
+    for (off_t off = 0; off < size; ) {
+        ssize_t r = pread(fd, buf, (size - off > (long long)sizeof(buf)) ? sizeof(buf) : (size_t)(size - off), off);
+        if (r < 0) { if (errno == EINTR) continue; perror("read"); return -1; }
+        if (r == 0) { fprintf(stderr, "Archivo truncado al calcular el CRC\n"); return -1; }
+        c = crc32c_update(c, buf, (size_t)r);
+        if (sha_hex) sha256_update(&sha, buf, (size_t)r);
+        off += r;
+    }
+    *crc = c;
+    if (sha_hex) { unsigned char d[32]; sha256_final(&sha, d); sha256_hex(d, sha_hex); }
+    return 0;
+}
+// Ofrece el contenido por su hash. 1 si el servidor ya lo tenía (FILE_OK dedup), 0 si hay
+// que enviarlo, -1 si se cortó la conexión.
+static int offer_hash(int sock, const char *hex, long long size, const char *name, long target) {
+    char cmd[512];
+    int n = snprintf(cmd, sizeof(cmd), binary ? "HAVE %s %lld %.255s" : "HAVE %s %lld %.255s\n", hex, size, name);
+    pthread_mutex_lock(&ack_mu);
+    long no0 = have_no;
+    pthread_mutex_unlock(&ack_mu);
+    if ((binary ? send_frame(sock, FR_CMD, cmd, (size_t)n) : (int)send(sock, cmd, (size_t)n, 0)) < 0) return -1;
+    pthread_mutex_lock(&ack_mu);
+    while (running && file_acks < target && have_no == no0) pthread_cond_wait(&ack_cv, &ack_mu);
+    int rc = file_acks >= target ? 1 : (have_no != no0 ? 0 : -1);
+    pthread_mutex_unlock(&ack_mu);
+    return rc;
+}
+// Cabecera: trama FR_FILE / FR_FILE_CRC en binario; si no, FILE/FILEZ en texto (o en FR_CMD)
+static int send_file_header(int sock, const char *name, long long sz, uint32_t crc) {
+    if (binary && !compress_on) {
+        unsigned char hdr[12 + 256];
+        size_t nl = strlen(name), fixed = crc_on ? 12 : 8;
+        if (nl > 255) nl = 255;
+        frame_put_u64(hdr, (uint64_t)sz);
+        if (crc_on) frame_put_u32(hdr + 8, crc);
+        memcpy(hdr + fixed, name, nl);
+        return send_frame(sock, crc_on ? FR_FILE_CRC : FR_FILE, hdr, fixed + nl);
+    }
+    char header[512];
+    const char *cmd = compress_on ? "FILEZ" : "FILE";
+    int hl = crc_on ? snprintf(header, sizeof(header), "%s %.255s %lld %08x", cmd, name, sz, crc)
+                    : snprintf(header, sizeof(header), "%s %.255s %lld", cmd, name, sz);
+    if (binary) return send_frame(sock, FR_CMD, header, (size_t)hl);
+    header[hl++] = '\n';
+    return send(sock, header, (size_t)hl, 0) == hl ? 0 : -1;
+}
 static int send_file(int sock, const char *path) {
     long long sz = file_size(path);
     if (sz < 0) { fprintf(stderr, "No se puede leer tamaño de %s\n", path); return -1; }
     const char *name = basename_simple(path);
 
-    char header[512];
-    snprintf(header, sizeof(header), "FILE %s %lld\n", name, sz);
-    if (send(sock, header, strlen(header), 0) < 0) return -1;
+    pthread_mutex_lock(&ack_mu);
+    long target = file_acks + 1;
+    pthread_mutex_unlock(&ack_mu);
 
     int fd = open(path, O_RDONLY);
     if (fd < 0) { perror("open"); return -1; }
-    char buf[BUFFER_SIZE];
-    long long remaining = sz;
-    while (remaining > 0) {
-        ssize_t r = read(fd, buf, (remaining > (long long)sizeof(buf)) ? sizeof(buf) : (size_t)remaining);
-        if (r < 0) { perror("read"); close(fd); return -1; }
-        if (r == 0) break;
-        ssize_t sent = 0;
-        while (sent < r) {
-            ssize_t w = send(sock, buf + sent, (size_t)(r - sent), 0);
-            if (w < 0) { if (errno == EINTR) continue; perror("send"); close(fd); return -1; }
-            sent += w;
+    struct timespec t0; clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint32_t crc = 0;
+    char sha[65];
+    if ((crc_on || dedup_on) && file_digest(fd, sz, &crc, dedup_on ? sha : NULL) != 0) { close(fd); return -1; }
+    struct timespec tc; clock_gettime(CLOCK_MONOTONIC, &tc);
+    if (dedup_on) {
+        int have = offer_hash(sock, sha, sz, name, target);
+        if (have != 0) {
+            close(fd);
+            if (have < 0) { fprintf(stderr, "Conexión cerrada esperando respuesta a HAVE\n"); return -1; }
+            printf("%s ya estaba en el servidor (sha256 %.16s..., %s): 0 de %lld bytes enviados\n",
+                   name, sha, sha256_backend(), sz);
+            return 0;
         }
-        remaining -= r;
     }
+
+    if (send_file_header(sock, name, sz, crc) < 0) { close(fd); return -1; }
+
+    int used_sendfile = 0;
+    long long wire = 0;
+    int rc = compress_on ? send_payload_z(sock, fd, sz, &wire) : send_payload(sock, fd, 0, sz, &used_sendfile);
+    close(fd);
+    if (rc != 0) return -1;
+
+    // reader_thread imprime la respuesta y avisa
+    pthread_mutex_lock(&ack_mu);
+    while (running && file_acks < target) pthread_cond_wait(&ack_cv, &ack_mu);
+    int ok = file_acks >= target;
+    pthread_mutex_unlock(&ack_mu);
+    if (!ok) { fprintf(stderr, "Conexión cerrada esperando FILE_OK\n"); return -1; }
+    struct timespec t1; clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double crc_secs = (double)(tc.tv_sec - t0.tv_sec) + (double)(tc.tv_nsec - t0.tv_nsec) / 1e9;
+    if (crc_on) printf("CRC32C %08x (%s, %.3f s)\n", crc, crc32c_backend(), crc_secs);
+    if (dedup_on) printf("No estaba en el servidor (sha256 %.16s..., %s): enviado entero\n", sha, sha256_backend());
+    if (compress_on)
+        printf("Enviado %s: %lld bytes -> %lld comprimidos (ratio %.2f) en %.3f s (%.1f MB/s efectivos, %.1f MB/s en el cable, lz)\n",
+               name, sz, wire, wire > 0 ? (double)sz / (double)wire : 1.0, secs,
+               secs > 0 ? (double)sz / secs / 1e6 : 0.0, secs > 0 ? (double)wire / secs / 1e6 : 0.0);
+    else
+        printf("Enviado %s: %lld bytes en %.3f s (%.1f MB/s, %s)\n", name, sz, secs,
+               secs > 0 ? (double)sz / secs / 1e6 : 0.0, used_sendfile ? "sendfile" : "copia");
+    return 0;
+}
+// --- /enviarlote: muchos archivos por la conexión principal sin esperar cada FILE_OK ---
+// El servidor los procesa en orden y responde en orden, así que basta con contar
+// respuestas: antes de mandar el archivo i se espera a que las confirmadas sean al menos
+// i - ventana + 1. Con una ventana de 1 es lo mismo que /enviar uno tras otro.
+static int send_batch(int sock, int window, const char *spec) {
+    struct stat st;
+    char pattern[1024];
+    if (stat(spec, &st) == 0 && S_ISDIR(st.st_mode)) snprintf(pattern, sizeof(pattern), "%s/*", spec);
+    else snprintf(pattern, sizeof(pattern), "%s", spec);
+    glob_t g;
+    if (glob(pattern, 0, NULL, &g) != 0) { fprintf(stderr, "Nada que enviar en %s\n", spec); return -1; }
+
+    pthread_mutex_lock(&ack_mu);
+    long base = file_acks, errs0 = file_errs;
+    pthread_mutex_unlock(&ack_mu);
+    acks_quiet = 1;
+    struct timespec t0; clock_gettime(CLOCK_MONOTONIC, &t0);
+    long sent = 0; long long bytes = 0;
+    int rc = 0;
+    for (size_t i = 0; i < g.gl_pathc && rc == 0; i++) {
+        const char *path = g.gl_pathv[i];
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) { perror(path); continue; }
+        long long sz = (long long)st.st_size, wire = 0;
+        uint32_t crc = 0;
+        int used_sendfile = 0;
+        pthread_mutex_lock(&ack_mu);
+        while (running && file_acks - base <= sent - window) pthread_cond_wait(&ack_cv, &ack_mu);
+        pthread_mutex_unlock(&ack_mu);
+        if (!running ||
+            (crc_on && file_digest(fd, sz, &crc, NULL) != 0) ||
+            send_file_header(sock, basename_simple(path), sz, crc) < 0 ||
+            (compress_on ? send_payload_z(sock, fd, sz, &wire) : send_payload(sock, fd, 0, sz, &used_sendfile)) != 0)
+            rc = -1;
+        else { sent++; bytes += sz; }
+        close(fd);
+    }
+    globfree(&g);
+    pthread_mutex_lock(&ack_mu);
+    while (running && file_acks - base < sent) pthread_cond_wait(&ack_cv, &ack_mu);
+    long acked = file_acks - base, errs = file_errs - errs0;
+    pthread_mutex_unlock(&ack_mu);
+    acks_quiet = 0;
+    struct timespec t1; clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("Lote %s: %ld archivos (%ld con error), %lld bytes en %.3f s: %.1f archivos/s, %.1f MB/s (ventana %d)\n",
+           spec, acked, errs, bytes, secs, secs > 0 ? (double)acked / secs : 0.0,
+           secs > 0 ? (double)bytes / secs / 1e6 : 0.0, window);
+    if (acked < sent) { fprintf(stderr, "Conexión cerrada con %ld archivos sin confirmar\n", sent - acked); return -1; }
+    return rc;
+}
+// /enviara: SENDTO y el contenido detrás; el servidor responde SENDTO_OK cuando el
+// destinatario ya lo ha recibido entero (o SENDTO_ERR, y lo enviado se descarta).
+static int send_to_user(int sock, const char *user, const char *path) {
+    long long sz = file_size(path);
+    if (sz < 0) { fprintf(stderr, "No se puede leer tamaño de %s\n", path); return -1; }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror("open"); return -1; }
+    pthread_mutex_lock(&ack_mu);
+    long target = file_acks + 1;
+    pthread_mutex_unlock(&ack_mu);
+
+    struct timespec t0; clock_gettime(CLOCK_MONOTONIC, &t0);
+    char header[512];
+    int hl = snprintf(header, sizeof(header), "SENDTO %.63s %.255s %lld", user, basename_simple(path), sz), hr;
+    if (binary) hr = send_frame(sock, FR_CMD, header, (size_t)hl);
+    else { header[hl++] = '\n'; hr = (int)send(sock, header, (size_t)hl, 0); }
+    int used_sendfile = 0;
+    int rc = hr < 0 ? -1 : send_payload(sock, fd, 0, sz, &used_sendfile);
     close(fd);
+    if (rc != 0) return -1;
+
+    pthread_mutex_lock(&ack_mu);
+    while (running && file_acks < target) pthread_cond_wait(&ack_cv, &ack_mu);
+    int ok = file_acks >= target;
+    pthread_mutex_unlock(&ack_mu);
+    if (!ok) { fprintf(stderr, "Conexión cerrada esperando SENDTO_OK\n"); return -1; }
+    struct timespec t1; clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%s -> %s: %lld bytes en %.3f s (%.1f MB/s, %s)\n", basename_simple(path), user, sz, secs,
+           secs > 0 ? (double)sz / secs / 1e6 : 0.0, used_sendfile ? "sendfile" : "copia");
+    return 0;
+}
+// Conecta por --unix o por TCP. Devuelve el socket o -1.
+static int connect_server(void) {
+    if (unix_path) {
+        struct sockaddr_un ua; memset(&ua, 0, sizeof(ua));
+        ua.sun_family = AF_UNIX;
+        if (strlen(unix_path) >= sizeof(ua.sun_path)) { fprintf(stderr, "--unix: ruta demasiado larga\n"); return -1; }
+        memcpy(ua.sun_path, unix_path, strlen(unix_path));
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0) { perror("socket"); return -1; }
+        if (connect(sock, (struct sockaddr*)&ua, sizeof(ua)) < 0) { perror(unix_path); close(sock); return -1; }
+        return sock;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) { perror("socket"); return -1; }
+
+    struct sockaddr_in serv_addr; memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET; serv_addr.sin_port = htons(PORT);
+    if (inet_pton(AF_INET, SERVER_IP, &serv_addr.sin_addr) <= 0) { perror("inet_pton"); close(sock); return -1; }
+    if (connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) { perror("connect"); close(sock); return -1; }
+    // Sin Nagle: la cabecera de un FILE y un contenido pequeño detrás no esperan al ACK
+    // retardado del servidor (~40 ms por archivo en /enviarlote)
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+static int open_session(io_ctx *ctx) {
+    int sock = connect_server();
+    if (sock < 0) return -1;
+
+    char auth[BUFFER_SIZE];
+    snprintf(auth, sizeof(auth), "AUTH %s %s\n", g_user, g_pass);
+    if (send(sock, auth, strlen(auth), 0) < 0) { perror("send AUTH"); close(sock); return -1; }
+
+    ctx->sock = sock;
+    rbuf_init(&ctx->in, ctx->in_mem, sizeof(ctx->in_mem));
+
+    char line[BUFFER_SIZE]; ssize_t n = rbuf_read_line(&ctx->in, sock, line, sizeof(line));
+    if (n <= 0) { fprintf(stderr, "Sin respuesta de autenticación.\n"); close(sock); return -1; }
+    rstrip_newline(line);
+    if (strcmp(line, "AUTH_OK") != 0) { fprintf(stderr, "Login fallido.\n"); close(sock); return -1; }
+    return 0;
+}
+static void close_session(io_ctx *ctx) {
+    send(ctx->sock, "salir\n", 6, MSG_NOSIGNAL);
+    close(ctx->sock);
+}
+
+// --- /enviarp: subida reanudable por rangos en paralelo ---
+#define CHUNK_SIZE (4LL << 20)
 
+typedef struct { long long off, len; } byte_range;
+
+typedef struct {
+    char id[40];
+    int fd;
+    byte_range *tasks;
+    size_t ntasks, next;           // next protegido por mu
+    long long sent;
+    int failed, used_sendfile;
+    pthread_mutex_t mu;
+} par_upload;
+
+typedef struct { par_upload *u; io_ctx conn; } par_worker;
+
+static void *par_worker_thread(void *arg) {
+    par_worker *w = (par_worker*)arg;
+    par_upload *u = w->u;
+    char line[BUFFER_SIZE];
+    while (1) {
+        pthread_mutex_lock(&u->mu);
+        if (u->failed || u->next >= u->ntasks) { pthread_mutex_unlock(&u->mu); break; }
+        byte_range t = u->tasks[u->next++];
+        pthread_mutex_unlock(&u->mu);
+
+        int hl = snprintf(line, sizeof(line), "CHUNK %s %lld %lld\n", u->id, t.off, t.len);
+        int sf = 0;
+        int ok = send(w->conn.sock, line, (size_t)hl, 0) == hl &&
+                  send_payload(w->conn.sock, u->fd, (off_t)t.off, t.len, &sf) == 0 &&
+                  rbuf_read_line(&w->conn.in, w->conn.sock, line, sizeof(line)) > 0 &&
+                  strncmp(line, "CHUNK_OK", 8) == 0;
+        pthread_mutex_lock(&u->mu);
+        if (ok) { u->sent += t.len; if (sf) u->used_sendfile = 1; }
+        else u->failed = 1;
+        pthread_mutex_unlock(&u->mu);
+    }
+    return NULL;
+}
+
+// Rangos pendientes = huecos de "off+len,off+len,..." (ordenados) partidos en trozos de CHUNK_SIZE.
+static size_t plan_missing(const char *have, long long total, byte_range **out) {
+    size_t n = 0, cap = 16;
+    byte_range *ts = (byte_range*)malloc(cap * sizeof(byte_range));
+    if (!ts) return 0;
+    long long pos = 0;
+    const char *p = have;
+    while (pos < total) {
+        long long roff = total, rlen = 0;
+        if (p && *p && *p != '-') {
+            if (sscanf(p, "%lld+%lld", &roff, &rlen) != 2) { roff = total; rlen = 0; }
+            p = strchr(p, ',');
+            if (p) p++;
+        }
+        for (long long o = pos; o < roff; o += CHUNK_SIZE) {
+            if (n == cap) {
+                byte_range *q = (byte_range*)realloc(ts, (cap *= 2) * sizeof(byte_range));
+                if (!q) break;
+                ts = q;
+            }
+            ts[n].off = o; ts[n].len = (roff - o > CHUNK_SIZE) ? CHUNK_SIZE : roff - o;
+            n++;
+        }
+        if (roff + rlen > pos) pos = roff + rlen;
+        if (roff >= total) break;
+    }
+    *out = ts;
+    return n;
+}
+
+static int send_file_parallel(int nconn, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) { perror(path); return -1; }
+    long long sz = (long long)st.st_size;
+    const char *name = basename_simple(path);
+
+    // Mismo fichero (nombre, tamaño, mtime) => mismo id => se retoma donde se quedó
+    unsigned long long h = 1469598103934665603ULL;
+    char key[512]; snprintf(key, sizeof(key), "%s|%lld|%lld", name, sz, (long long)st.st_mtime);
+    for (const char *k = key; *k; k++) { h ^= (unsigned char)*k; h *= 1099511628211ULL; }
+
+    par_upload u; memset(&u, 0, sizeof(u));
+    snprintf(u.id, sizeof(u.id), "%016llx", h);
+    pthread_mutex_init(&u.mu, NULL);
+    u.fd = open(path, O_RDONLY);
+    if (u.fd < 0) { perror("open"); return -1; }
+
+    par_worker *ws = (par_worker*)calloc((size_t)nconn, sizeof(par_worker));
+    pthread_t *th = (pthread_t*)calloc((size_t)nconn, sizeof(pthread_t));
+    int opened = 0, rc = -1;
     char line[BUFFER_SIZE];
-    ssize_t n = read_line(sock, line, sizeof(line));
-    if (n <= 0) { fprintf(stderr, "Conexión cerrada esperando FILE_OK\n"); return -1; }
+    if (!ws || !th || open_session(&ws[0].conn) != 0) goto out;
+    opened = 1;
+
+    snprintf(line, sizeof(line), "UPLOAD %s %s %lld\n", u.id, name, sz);
+    send(ws[0].conn.sock, line, strlen(line), 0);
+    char id[64], have[BUFFER_SIZE]; long long total = -1, already = 0;
+    if (rbuf_read_line(&ws[0].conn.in, ws[0].conn.sock, line, sizeof(line)) <= 0 ||
+        sscanf(line, "UPLOAD_HAVE %63s %lld %lld %4000s", id, &total, &already, have) != 4 || total != sz) {
+        fprintf(stderr, "Respuesta inesperada: %s", line);
+        goto out;
+    }
+    u.ntasks = plan_missing(have, total, &u.tasks);
+    printf("Subida %s: %lld bytes, ya en el servidor %lld, %zu rangos pendientes sobre %d conexiones\n",
+           u.id, sz, already, u.ntasks, nconn);
+
+    struct timespec t0; clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < nconn; i++) {
+        if (i > 0 && open_session(&ws[i].conn) != 0) break;
+        opened = i + 1;
+        ws[i].u = &u;
+        if (pthread_create(&th[i], NULL, par_worker_thread, &ws[i]) != 0) { opened = i; if (i > 0) close_session(&ws[i].conn); break; }
+    }
+    for (int i = 0; i < opened; i++) pthread_join(th[i], NULL);
+    if (u.failed || u.next < u.ntasks) { fprintf(stderr, "Subida incompleta; repite el comando para reanudar.\n"); goto out; }
+
+    snprintf(line, sizeof(line), "UPDONE %s\n", u.id);
+    send(ws[0].conn.sock, line, strlen(line), 0);
+    if (rbuf_read_line(&ws[0].conn.in, ws[0].conn.sock, line, sizeof(line)) <= 0) goto out;
     fputs(line, stdout);
+    if (strncmp(line, "FILE_OK", 7) != 0) goto out;
+    struct timespec t1; clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("Enviado %s: %lld bytes nuevos en %.3f s (%.1f MB/s, %d conexiones, %s)\n", name, u.sent, secs,
+           secs > 0 ? (double)u.sent / secs / 1e6 : 0.0, nconn, u.used_sendfile ? "sendfile" : "copia");
+    rc = 0;
+out:
+    for (int i = 0; i < opened; i++) close_session(&ws[i].conn);
+    free(ws); free(th); free(u.tasks);
+    close(u.fd);
+    return rc;
+}
+
+static void file_ack(const char *reply) {
+    if (strncmp(reply, "HAVE_NO", 7) == 0 || strncmp(reply, "HAVE_ERR", 8) == 0) {
+        pthread_mutex_lock(&ack_mu);
+        have_no++;
+        pthread_cond_broadcast(&ack_cv);
+        pthread_mutex_unlock(&ack_mu);
+        return;
+    }
+    if (strncmp(reply, "GET_OK", 6) == 0 || strncmp(reply, "GET_ERR", 7) == 0) {
+        pthread_mutex_lock(&ack_mu);
+        gets_pending--;
+        pthread_cond_broadcast(&ack_cv);
+        pthread_mutex_unlock(&ack_mu);
+        return;
+    }
+    if (strncmp(reply, "FILE_OK", 7) == 0 || strncmp(reply, "FILE_ERR", 8) == 0 ||
+        strncmp(reply, "SENDTO_OK", 9) == 0 || strncmp(reply, "SENDTO_ERR", 10) == 0) {
+        pthread_mutex_lock(&ack_mu);
+        file_acks++;
+        if (strncmp(reply, "FILE_ERR", 8) == 0) file_errs++;
+        pthread_cond_broadcast(&ack_cv);
+        pthread_mutex_unlock(&ack_mu);
+    }
+}
+static int pwrite_all(int fd, const char *p, size_t n, off_t off) {
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w; n -= (size_t)w; off += w;
+    }
+    return 0;
+}
+// Contenido de un GET_OK o un RELAY (lo lee reader_thread, el único lector del socket). Lo
+// que ya estaba en el rbuf se escribe tal cual; el resto va socket -> pipe -> fichero con
+// splice(), sin pasar por espacio de usuario, o recv + pwrite si no hay splice. Cada byte va
+// a su offset, así varios rangos del mismo archivo lo completan. Si no se puede escribir en
+// disco, el contenido se lee igual y se descarta. -1 si la conexión ya no sirve.
+static int receive_content(io_ctx *ctx, const char *name, long long off, long long len, long long total, const char *from) {
+    char path[512]; snprintf(path, sizeof(path), "%s/%s", DOWNLOAD_DIR, basename_simple(name));
+    int fd = -1;
+    if (mkdir(DOWNLOAD_DIR, 0755) == 0 || errno == EEXIST) fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) perror(path);
+    struct timespec t0; clock_gettime(CLOCK_MONOTONIC, &t0);
+    off_t pos = (off_t)off;
+    long long left = len, spliced = 0;
+
+    size_t take = rbuf_len(&ctx->in);
+    if ((long long)take > left) take = (size_t)left;
+    if (take > 0) {
+        if (fd >= 0 && pwrite_all(fd, rbuf_peek(&ctx->in), take, pos) != 0) { perror(path); close(fd); fd = -1; }
+        rbuf_consume(&ctx->in, take);
+        pos += (off_t)take; left -= (long long)take;
+    }
+
+    int pfd[2];
+    if (zerocopy && fd >= 0 && left > 0 && pipe2(pfd, O_CLOEXEC) == 0) {
+        while (left > 0) {
+            ssize_t n = splice(ctx->sock, NULL, pfd[1], NULL, left > SPLICE_CHUNK ? SPLICE_CHUNK : (size_t)left,
+                               SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL && spliced == 0) break;       // sin splice(): copia
+            if (n <= 0) { if (n < 0) perror("splice"); close(pfd[0]); close(pfd[1]); if (fd >= 0) close(fd); return -1; }
+            for (ssize_t m = n; m > 0; ) {
+                ssize_t w = fd >= 0 ? splice(pfd[0], NULL, fd, &pos, (size_t)m, SPLICE_F_MOVE) : -1;
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) {                                          // disco: vaciar el pipe y descartar
+                    if (fd >= 0) { perror(path); close(fd); fd = -1; }
+                    char junk[BUFFER_SIZE];
+                    w = read(pfd[0], junk, (size_t)m < sizeof(junk) ? (size_t)m : sizeof(junk));
+                    if (w <= 0) { close(pfd[0]); close(pfd[1]); return -1; }
+                }
+                m -= w;
+            }
+            left -= n; spliced += n;
+            if (fd < 0) break;
+        }
+        close(pfd[0]); close(pfd[1]);
+    }
+    static char buf[16 * BUFFER_SIZE];
+    while (left > 0) {
+        ssize_t r = recv(ctx->sock, buf, left > (long long)sizeof(buf) ? sizeof(buf) : (size_t)left, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) { if (r < 0) perror("recv"); if (fd >= 0) close(fd); return -1; }
+        if (fd >= 0 && pwrite_all(fd, buf, (size_t)r, pos) != 0) { perror(path); close(fd); fd = -1; }
+        pos += r; left -= r;
+    }
+    if (fd < 0) { printf("Descarga de %s descartada.\n", name); return 0; }
+    if (off == 0 && len == total && ftruncate(fd, (off_t)total) != 0) perror(path);   // archivo entero
+    close(fd);
+    struct timespec t1; clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (from)
+        printf("Recibido de %s %s -> %s: %lld bytes en %.3f s (%.1f MB/s, %s)\n", from, name, path, len, secs,
+               secs > 0 ? (double)len / secs / 1e6 : 0.0, spliced > 0 ? "splice" : "copia");
+    else
+        printf("Descargado %s -> %s: %lld bytes [%lld, %lld) de %lld en %.3f s (%.1f MB/s, %s)\n", name, path, len,
+               off, off + len, total, secs, secs > 0 ? (double)len / secs / 1e6 : 0.0, spliced > 0 ? "splice" : "copia");
     return 0;
 }
+static int receive_download(io_ctx *ctx, const char *reply) {
+    char name[256]; long long off, len, total;
+    if (sscanf(reply, "GET_OK %255s %lld %lld %lld", name, &off, &len, &total) != 4 || off < 0 || len < 0) {
+        fprintf(stderr, "Cabecera GET_OK inválida\n"); return -1;
+    }
+    return receive_content(ctx, name, off, len, total, NULL);
+}
+// "RELAY <de> <nombre> <bytes>": archivo que otro usuario nos manda con SENDTO
+static int receive_relay(io_ctx *ctx, const char *reply) {
+    char from[256], name[256]; long long len;
+    if (sscanf(reply, "RELAY %255s %255s %lld", from, name, &len) != 3 || len < 0) {
+        fprintf(stderr, "Cabecera RELAY inválida\n"); return -1;
+    }
+    return receive_content(ctx, name, 0, len, len, from);
+}
+
+// Una trama del servidor: FR_MSG (eco) o FR_REPLY (texto de respuesta). Mismo retorno que rbuf_read_line().
+static ssize_t read_frame(io_ctx *ctx, int *type, char *buf, size_t maxlen) {
+    unsigned char h[FRAME_HDR];
+    ssize_t r = rbuf_read_n(&ctx->in, ctx->sock, h, sizeof(h));
+    if (r <= 0) return r;
+    uint32_t len = frame_len(h), keep = len < maxlen - 1 ? len : (uint32_t)(maxlen - 1);
+    if (keep > 0 && (r = rbuf_read_n(&ctx->in, ctx->sock, buf, keep)) <= 0) return r;
+    buf[keep] = '\0';
+    for (uint32_t left = len - keep; left > 0; ) {         // lo que no cabe se descarta
+        char tmp[BUFFER_SIZE];
+        uint32_t n = left < sizeof(tmp) ? left : (uint32_t)sizeof(tmp);
+        if ((r = rbuf_read_n(&ctx->in, ctx->sock, tmp, n)) <= 0) return r;
+        left -= n;
+    }
+    *type = h[0];
+    return (ssize_t)keep;
+}
+
 static void *reader_thread(void *arg) {
     io_ctx *ctx = (io_ctx*)arg;
-    char line[BUFFER_SIZE];
+    char line[2 * BUFFER_SIZE];
     while (running) {
-        ssize_t n = read_line(ctx->sock, line, sizeof(line));
+        int type = FR_REPLY;
+        ssize_t n = binary ? read_frame(ctx, &type, line, sizeof(line))
+                           : rbuf_read_line(&ctx->in, ctx->sock, line, sizeof(line));
         if (n == 0) { printf("Conexión cerrada por el servidor.\n"); running = 0; break; }
         if (n < 0) { perror("recv"); running = 0; break; }
+        if (type == FR_MSG) { fwrite(line, 1, (size_t)n, stdout); putchar('\n'); continue; }
         if (strncasecmp(line, "BYE", 3) == 0) { printf("Servidor solicitó terminar.\n"); running = 0; break; }
-        fputs(line, stdout);
+        if (!acks_quiet || strncmp(line, "FILE_OK", 7) != 0) fputs(line, stdout);
+        if (strncmp(line, "GET_OK", 6) == 0 && receive_download(ctx, line) != 0) { running = 0; break; }
+        if (strncmp(line, "RELAY ", 6) == 0 && receive_relay(ctx, line) != 0) { running = 0; break; }
+        file_ack(line);
     }
+    // Despierta a send_file() si estaba esperando
+    pthread_mutex_lock(&ack_mu);
+    pthread_cond_broadcast(&ack_cv);
+    pthread_mutex_unlock(&ack_mu);
     return NULL;
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-zerocopy") == 0) zerocopy = 0;
+        else if (strcmp(argv[i], "--binary") == 0) binary = 1;
+        else if (strcmp(argv[i], "--compress") == 0) compress_on = 1;
+        else if (strcmp(argv[i], "--crc") == 0) crc_on = 1;
+        else if (strcmp(argv[i], "--no-crc") == 0) crc_on = 0;     // el de antes: ya es así por defecto
+        else if (strcmp(argv[i], "--dedup") == 0) dedup_on = 1;
+        else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) unix_path = argv[++i];
+        else { fprintf(stderr, "Uso: %s [--no-zerocopy] [--binary] [--compress] [--crc] [--dedup] [--unix RUTA]\n", argv[0]); return 1; }
+    }
     signal(SIGPIPE, SIG_IGN);
 
-    char user[256], pass[256];
     printf("Usuario: "); fflush(stdout);
-    if (!fgets(user, sizeof(user), stdin)) return 1;
-    rstrip_newline(user);
+    if (!fgets(g_user, sizeof(g_user), stdin)) return 1;
+    rstrip_newline(g_user);
     printf("Password: "); fflush(stdout);
-    if (!fgets(pass, sizeof(pass), stdin)) return 1;
-    rstrip_newline(pass);
+    if (!fgets(g_pass, sizeof(g_pass), stdin)) return 1;
+    rstrip_newline(g_pass);
 
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) { perror("socket"); return 1; }
-
-    struct sockaddr_in serv_addr; memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET; serv_addr.sin_port = htons(PORT);
-    if (inet_pton(AF_INET, SERVER_IP, &serv_addr.sin_addr) <= 0) { perror("inet_pton"); close(sock); return 1; }
-    if (connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) { perror("connect"); close(sock); return 1; }
+    static io_ctx ctx;
+    if (open_session(&ctx) != 0) return 1;
+    int sock = ctx.sock;
 
-    char auth[BUFFER_SIZE];
-    snprintf(auth, sizeof(auth), "AUTH %s %s\n", user, pass);
-    if (send(sock, auth, strlen(auth), 0) < 0) { perror("send AUTH"); close(sock); return 1; }
-
-    char line[BUFFER_SIZE]; ssize_t n = read_line(sock, line, sizeof(line));
-    if (n <= 0) { fprintf(stderr, "Sin respuesta de autenticación.\n"); close(sock); return 1; }
-    rstrip_newline(line);
-    if (strcmp(line, "AUTH_OK") != 0) { fprintf(stderr, "Login fallido.\n"); close(sock); return 1; }
+    if (compress_on) {
+        char line[BUFFER_SIZE];
+        if (send(sock, "COMPRESS lz\n", 12, 0) != 12 || rbuf_read_line(&ctx.in, sock, line, sizeof(line)) <= 0 ||
+            strncmp(line, "COMPRESS_OK", 11) != 0) {
+            printf("El servidor no acepta compresión: se envía sin comprimir.\n");
+            compress_on = 0;
+        }
+    }
+    if (binary) {
+        char line[BUFFER_SIZE];
+        if (send(sock, "BINARY\n", 7, 0) != 7 || rbuf_read_line(&ctx.in, sock, line, sizeof(line)) <= 0 ||
+            strncmp(line, "BINARY_OK", 9) != 0) {
+            fprintf(stderr, "El servidor no acepta el modo binario.\n"); close(sock); return 1;
+        }
+    }
 
-    printf("Login OK. Escribe mensajes. Usa '/enviar <ruta>' para enviar archivo. 'salir' para terminar.\n");
+    printf("Login OK. Escribe mensajes. Usa '/enviar <ruta>' o '/enviarp <n> <ruta>' para enviar archivo, '/enviarlote <ventana> <directorio>' para muchos, '/enviara <usuario> <ruta>' para mandarlo a otro usuario, '/bajar <nombre>' para descargarlo. 'salir' para terminar.\n");
 
-    io_ctx ctx = { .sock = sock };
     pthread_t th;
     if (pthread_create(&th, NULL, reader_thread, &ctx) != 0) { perror("pthread_create"); close(sock); return 1; }
 
@@ -146,18 +765,65 @@ int main(void) {
             if (send_file(sock, path) != 0) printf("Error enviando archivo.\n");
             continue;
         }
+        if (strncmp(input, "/enviara ", 9) == 0) {
+            char user[64]; int used = 0;
+            if (sscanf(input + 9, "%63s %n", user, &used) != 1 || input[9 + used] == '\0') {
+                printf("Uso: /enviara <usuario> <ruta>\n"); continue;
+            }
+            if (send_to_user(sock, user, input + 9 + used) != 0) printf("Error enviando archivo.\n");
+            continue;
+        }
+        if (strncmp(input, "/bajar ", 7) == 0) {
+            char name[256], cmd[BUFFER_SIZE]; long long off = 0, len = 0;
+            int n = sscanf(input + 7, "%255s %lld %lld", name, &off, &len);
+            if (n != 1 && (n != 3 || off < 0 || len < 0)) { printf("Uso: /bajar <nombre> [offset len]\n"); continue; }
+            int cl = n == 3 ? snprintf(cmd, sizeof(cmd), "GET %s %lld %lld", name, off, len)
+                            : snprintf(cmd, sizeof(cmd), "GET %s", name);
+            int rc;
+            if (binary) rc = send_frame(sock, FR_CMD, cmd, (size_t)cl);
+            else { cmd[cl++] = '\n'; rc = send(sock, cmd, (size_t)cl, 0) == cl ? 0 : -1; }
+            if (rc != 0) { perror("send"); break; }
+            pthread_mutex_lock(&ack_mu); gets_pending++; pthread_mutex_unlock(&ack_mu);
+            continue;
+        }
+        if (strncmp(input, "/enviarlote ", 12) == 0) {
+            int window = 0, used = 0;
+            if (sscanf(input + 12, "%d %n", &window, &used) != 1 || window <= 0 || input[12 + used] == '\0') {
+                printf("Uso: /enviarlote <ventana> <directorio|patrón>\n"); continue;
+            }
+            if (send_batch(sock, window, input + 12 + used) != 0) printf("Error enviando el lote.\n");
+            continue;
+        }
+        if (strncmp(input, "/enviarp ", 9) == 0) {
+            int nconn = 0, used = 0;
+            if (sscanf(input + 9, "%d %n", &nconn, &used) != 1 || nconn <= 0 || input[9 + used] == '\0') {
+                printf("Uso: /enviarp <conexiones> <ruta>\n"); continue;
+            }
+            if (send_file_parallel(nconn, input + 9 + used) != 0) printf("Error enviando archivo.\n");
+            continue;
+        }
 
         if (strncasecmp(input, "salir", 5) == 0 && (input[5] == '\0' || isspace((unsigned char)input[5]))) {
-            const char *bye = "salir\n";
-            if (send(sock, bye, strlen(bye), 0) < 0) perror("send salir");
+            int rc = binary ? send_frame(sock, FR_CMD, "salir", 5) : (int)send(sock, "salir\n", 6, 0);
+            if (rc < 0) perror("send salir");
             break;
         }
 
+        if (binary) {
+            size_t len = strlen(input);
+            if (len > FRAME_MAX) { printf("Mensaje demasiado largo (máx. %d bytes)\n", FRAME_MAX); continue; }
+            if (send_frame(sock, is_command(input) ? FR_CMD : FR_MSG, input, len) != 0) { perror("send"); break; }
+            continue;
+        }
         char msg[BUFFER_SIZE + 2];
         snprintf(msg, sizeof(msg), "%s\n", input);
         if (send(sock, msg, strlen(msg), 0) < 0) { perror("send"); break; }
     }
 
+    // Las descargas pedidas terminan antes de cerrar (el servidor las atiende en orden)
+    pthread_mutex_lock(&ack_mu);
+    while (running && gets_pending > 0) pthread_cond_wait(&ack_cv, &ack_mu);
+    pthread_mutex_unlock(&ack_mu);
     running = 0;
     shutdown(sock, SHUT_RDWR);
     pthread_join(th, NULL);
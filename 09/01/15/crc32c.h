@@ -0,0 +1,82 @@
+// crc32c.h
+// CRC32C (Castagnoli) incremental para verificar subidas sin releer el archivo.
+// - En x86-64 con SSE4.2 usa la instrucción crc32 (8 bytes por instrucción); si no,
+//   tablas "slicing-by-8" en C portable. Se elige una vez, en la primera llamada.
+// - Uso: crc = 0; crc = crc32c_update(crc, buf, n); ... (mismo resultado troceado o no).
+//   crc32c_update(0, "123456789", 9) == 0xE3069283.
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u        // polinomio reflejado
+
+static uint32_t crc32c_tab[8][256];
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static inline uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n) {
+    while (n && ((uintptr_t)p & 7)) { crc = crc32c_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8); n--; }
+    while (n >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4); memcpy(&hi, p + 4, 4);   // little-endian
+        lo ^= crc;
+        crc = crc32c_tab[7][lo & 0xff] ^ crc32c_tab[6][(lo >> 8) & 0xff] ^
+              crc32c_tab[5][(lo >> 16) & 0xff] ^ crc32c_tab[4][lo >> 24] ^
+              crc32c_tab[3][hi & 0xff] ^ crc32c_tab[2][(hi >> 8) & 0xff] ^
+              crc32c_tab[1][(hi >> 16) & 0xff] ^ crc32c_tab[0][hi >> 24];
+        p += 8; n -= 8;
+    }
+    while (n--) crc = crc32c_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n) {
+    uint64_t c = crc;
+    while (n && ((uintptr_t)p & 7)) { c = _mm_crc32_u8((uint32_t)c, *p++); n--; }
+    while (n >= 8) {
+        uint64_t v; memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8; n -= 8;
+    }
+    while (n--) c = _mm_crc32_u8((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#endif
+
+static inline void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+        crc32c_tab[0][i] = c;
+    }
+    for (int t = 1; t < 8; t++)
+        for (int i = 0; i < 256; i++)
+            crc32c_tab[t][i] = (crc32c_tab[t - 1][i] >> 8) ^ crc32c_tab[0][crc32c_tab[t - 1][i] & 0xff];
+    crc32c_impl = crc32c_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc32c_impl = crc32c_hw;
+#endif
+}
+
+// "sse4.2" o "software", para los informes
+static inline const char *crc32c_backend(void) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_impl == crc32c_sw ? "software" : "sse4.2";
+}
+
+static inline uint32_t crc32c_update(uint32_t crc, const void *buf, size_t n) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_impl(~crc, (const unsigned char*)buf, n);
+}
+
+#endif
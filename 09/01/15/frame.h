@@ -0,0 +1,51 @@
+// frame.h
+// Modo binario opcional del protocolo (server.c y client.c), negociado tras AUTH_OK:
+//   cliente: "BINARY\n"  ->  servidor: "BINARY_OK\n"   (última línea de texto)
+// A partir de ahí cada mensaje va en una trama [tipo:1][longitud:4, big-endian][carga].
+// - No hay que buscar '\n' ni hacer sscanf de cabeceras: la longitud dice dónde acaba.
+// - La carga puede llevar cualquier byte (saltos de línea incluidos).
+// - El contenido de un FILE sigue a su trama sin enmarcar (igual que en modo texto),
+//   así splice()/sendfile() funcionan igual.
+// - Las respuestas de comandos (FILE_OK, STATS ...) viajan en FR_REPLY con el mismo
+//   texto que en modo texto.
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+#define FRAME_HDR 5
+#define FRAME_MAX 4091             // carga máxima: la trama entera cabe en el rbuf (BUFFER_SIZE)
+
+enum {
+    FR_MSG   = 1,                  // mensaje de chat (eco del servidor: "SERVIDOR: " + carga)
+    FR_CMD   = 2,                  // comando de texto sin '\n': salir, STATS, UPLOAD, CHUNK ...
+    FR_REPLY = 3,                  // respuesta del servidor a un comando (texto con '\n')
+    FR_FILE  = 4,                  // [bytes:8, big-endian][nombre] + contenido sin enmarcar
+    FR_FILE_CRC = 5,               // [bytes:8][crc32c:4][nombre] + contenido: FILE verificado
+};
+
+static inline void frame_put_hdr(unsigned char *h, int type, uint32_t len) {
+    h[0] = (unsigned char)type;
+    h[1] = (unsigned char)(len >> 24); h[2] = (unsigned char)(len >> 16);
+    h[3] = (unsigned char)(len >> 8);  h[4] = (unsigned char)len;
+}
+static inline uint32_t frame_len(const unsigned char *h) {
+    return ((uint32_t)h[1] << 24) | ((uint32_t)h[2] << 16) | ((uint32_t)h[3] << 8) | h[4];
+}
+static inline void frame_put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16); p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+}
+static inline uint32_t frame_get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+static inline void frame_put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--) { p[i] = (unsigned char)v; v >>= 8; }
+}
+static inline uint64_t frame_get_u64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+#endif
@@ -0,0 +1,78 @@
+// hist.h
+// Histograma de latencias estilo HDR (log-lineal): cada potencia de 2 se divide en
+// HIST_SUB sub-cubetas, así el error relativo es < 1/HIST_SUB (~6%) en todo el rango
+// de uint64 con tamaño fijo. Registrar es un par de incrementos atómicos relajados,
+// de modo que varios hilos (o procesos sobre memoria compartida) pueden escribir a la vez.
+// Lo usan server.c (métricas) y bench.c (informe de carga).
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    atomic_ullong count, sum, max;
+    atomic_ullong b[HIST_BUCKETS];
+} hist;
+
+static inline int hist_bucket(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((v >> shift) & (HIST_SUB - 1));
+}
+// Valor representativo (punto medio) de la cubeta i
+static inline uint64_t hist_value(int i) {
+    if (i < HIST_SUB) return (uint64_t)i;
+    int shift = i / HIST_SUB - 1;
+    uint64_t lo = (uint64_t)(HIST_SUB + i % HIST_SUB) << shift;
+    return lo + (((uint64_t)1 << shift) >> 1);
+}
+
+static inline void hist_record(hist *h, uint64_t v) {
+    atomic_fetch_add_explicit(&h->b[hist_bucket(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    unsigned long long m = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (v > m && !atomic_compare_exchange_weak_explicit(&h->max, &m, v, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+static inline void hist_merge(hist *dst, hist *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        unsigned long long n = atomic_load_explicit(&src->b[i], memory_order_relaxed);
+        if (n) atomic_fetch_add_explicit(&dst->b[i], n, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&dst->count, atomic_load_explicit(&src->count, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_add_explicit(&dst->sum, atomic_load_explicit(&src->sum, memory_order_relaxed), memory_order_relaxed);
+    unsigned long long m = atomic_load_explicit(&src->max, memory_order_relaxed);
+    if (m > atomic_load_explicit(&dst->max, memory_order_relaxed)) atomic_store_explicit(&dst->max, m, memory_order_relaxed);
+}
+
+// Percentil p en [0, 100]; 0 si el histograma está vacío.
+static inline uint64_t hist_percentile(hist *h, double p) {
+    unsigned long long total = atomic_load_explicit(&h->count, memory_order_relaxed);
+    if (total == 0) return 0;
+    unsigned long long rank = (unsigned long long)((p / 100.0) * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    unsigned long long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += atomic_load_explicit(&h->b[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t v = hist_value(i), m = atomic_load_explicit(&h->max, memory_order_relaxed);
+            return v < m ? v : m;
+        }
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+static inline uint64_t hist_mean(hist *h) {
+    unsigned long long n = atomic_load_explicit(&h->count, memory_order_relaxed);
+    return n ? atomic_load_explicit(&h->sum, memory_order_relaxed) / n : 0;
+}
+
+#endif
@@ -0,0 +1,112 @@
+// lz.h
+// Compresión LZ77 por bloques (estilo LZ4) para las subidas FILEZ, sin dependencias.
+// Lo usan client.c (comprime mientras envía) y server.c (descomprime directo al fichero).
+// - El contenido viaja en bloques de hasta LZ_BLOCK bytes originales:
+//     [longitud en el cable:4][longitud original:4][datos]   (big-endian)
+//   con el bit LZ_STORED en la primera si el bloque va sin comprimir (no compensaba).
+// - Cada bloque es independiente: memoria acotada en ambos lados, nunca el archivo entero.
+// - Formato de un bloque comprimido: secuencias [token][literales][offset:2 LE][+long. match],
+//   token = (literales << 4) | (match - 4); 15 en un nibble = sigue la longitud en bytes de 255.
+//   La última secuencia solo lleva literales.
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_BLOCK (64 * 1024)
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)     // peor caso de lz_compress()
+#define LZ_HDR 8
+#define LZ_STORED 0x80000000u
+#define LZ_HASH_BITS 13
+#define LZ_MIN_MATCH 4
+
+static inline void lz_put_hdr(unsigned char *h, uint32_t wire, uint32_t raw) {
+    for (int i = 0; i < 4; i++) { h[i] = (unsigned char)(wire >> (24 - 8 * i)); h[4 + i] = (unsigned char)(raw >> (24 - 8 * i)); }
+}
+static inline void lz_get_hdr(const unsigned char *h, uint32_t *wire, uint32_t *raw) {
+    *wire = ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | ((uint32_t)h[2] << 8) | h[3];
+    *raw  = ((uint32_t)h[4] << 24) | ((uint32_t)h[5] << 16) | ((uint32_t)h[6] << 8) | h[7];
+}
+
+static inline uint32_t lz_read32(const unsigned char *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint32_t lz_hash(uint32_t v) { return (v * 2654435761u) >> (32 - LZ_HASH_BITS); }
+static inline unsigned char *lz_put_len(unsigned char *op, size_t n) {
+    while (n >= 255) { *op++ = 255; n -= 255; }
+    *op++ = (unsigned char)n;
+    return op;
+}
+
+// Comprime src[0, n) (n <= LZ_BLOCK) en dst, de al menos LZ_BOUND(n) bytes. Devuelve lo escrito.
+static inline size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst) {
+    uint16_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const unsigned char *ip = src, *anchor = src, *end = src + n;
+    const unsigned char *mflimit = n > 12 ? end - 12 : src;    // ningún match empieza más allá
+    unsigned char *op = dst;
+    while (ip < mflimit) {
+        uint32_t seq = lz_read32(ip), h = lz_hash(seq);
+        const unsigned char *ref = src + table[h];
+        table[h] = (uint16_t)(ip - src);
+        if (ref >= ip || lz_read32(ref) != seq) {
+            ip += 1 + ((size_t)(ip - anchor) >> 6);              // datos poco compresibles: saltar más
+            continue;
+        }
+        const unsigned char *mp = ip + LZ_MIN_MATCH, *rp = ref + LZ_MIN_MATCH;
+        while (mp < end - 5 && *mp == *rp) { mp++; rp++; }
+        size_t lit = (size_t)(ip - anchor), mlen = (size_t)(mp - ip) - LZ_MIN_MATCH;
+        unsigned char *token = op++;
+        *token = (unsigned char)(((lit >= 15 ? 15 : lit) << 4) | (mlen >= 15 ? 15 : mlen));
+        if (lit >= 15) op = lz_put_len(op, lit - 15);
+        memcpy(op, anchor, lit); op += lit;
+        size_t off = (size_t)(ip - ref);
+        *op++ = (unsigned char)off; *op++ = (unsigned char)(off >> 8);
+        if (mlen >= 15) op = lz_put_len(op, mlen - 15);
+        ip = anchor = mp;
+    }
+    size_t lit = (size_t)(end - anchor);
+    *op++ = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = lz_put_len(op, lit - 15);
+    memcpy(op, anchor, lit); op += lit;
+    return (size_t)(op - dst);
+}
+
+// Lee una longitud extendida; false si el bloque se acaba antes.
+static inline int lz_get_len(const unsigned char **ip, const unsigned char *iend, size_t *n) {
+    unsigned char b;
+    do {
+        if (*ip >= iend) return 0;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 1;
+}
+
+// Descomprime src[0, n) en dst (capacidad cap). Devuelve los bytes producidos, -1 si el bloque es inválido.
+static inline long lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+    const unsigned char *ip = src, *iend = src + n;
+    unsigned char *op = dst, *oend = dst + cap;
+    while (ip < iend) {
+        unsigned tok = *ip++;
+        size_t lit = tok >> 4;
+        if (lit == 15 && !lz_get_len(&ip, iend, &lit)) return -1;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, lit); op += lit; ip += lit;
+        if (ip == iend) break;                                   // última secuencia
+        if (iend - ip < 2) return -1;
+        size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t mlen = tok & 15;
+        if (mlen == 15 && !lz_get_len(&ip, iend, &mlen)) return -1;
+        mlen += LZ_MIN_MATCH;
+        if (off == 0 || off > (size_t)(op - dst) || mlen > (size_t)(oend - op)) return -1;
+        const unsigned char *m = op - off;
+        if (off >= mlen) { memcpy(op, m, mlen); op += mlen; }
+        else while (mlen--) *op++ = *m++;                        // solapado: repite el patrón
+    }
+    return (long)(op - dst);
+}
+
+#endif
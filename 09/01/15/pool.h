@@ -0,0 +1,100 @@
+// pool.h
+// Reserva de objetos de tamaño fijo por bloques (slab) con caché por hilo.
+// - Cada bloque es un mmap() de per_slab objetos; las páginas solo ocupan memoria al
+//   usarse y los objetos liberados se reutilizan, nunca vuelven al sistema.
+// - Cada hilo toma y devuelve objetos en su caché (sin cerrojos); solo al vaciarse o
+//   llenarse pasa POOL_BATCH objetos de una vez al depósito compartido (con mutex).
+//   Un objeto se puede devolver desde otro hilo distinto del que lo tomó.
+// - Tamaño redondeado a 64 bytes: objetos de hilos distintos no comparten línea de caché.
+// - Uso: static pool p = POOL_INIT("nombre", tamaño, por_bloque);
+//        static __thread pool_cache tc;
+//        void *o = pool_get(&p, &tc); ... pool_put(&p, &tc, o);
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define POOL_CACHE 64              // objetos como máximo en la caché de un hilo
+#define POOL_BATCH 32              // objetos que se mueven entre caché y depósito
+
+typedef struct pool_obj { struct pool_obj *next; } pool_obj;
+
+typedef struct {
+    const char *name;
+    size_t size;                   // bytes por objeto (múltiplo de 64)
+    size_t per_slab;
+    pthread_mutex_t mu;
+    pool_obj *depot;               // libres compartidos
+    atomic_size_t slabs, in_use;
+} pool;
+
+typedef struct {
+    pool_obj *head;
+    int n;
+} pool_cache;
+
+#define POOL_INIT(nm, sz, per) \
+    { .name = (nm), .size = ((sz) + 63) & ~(size_t)63, .per_slab = (per), .mu = PTHREAD_MUTEX_INITIALIZER }
+
+// Pasa a la caché hasta POOL_BATCH objetos del depósito; si está vacío, de un bloque nuevo.
+static inline void pool_refill(pool *p, pool_cache *tc) {
+    pthread_mutex_lock(&p->mu);
+    if (!p->depot) {
+        char *m = (char*)mmap(NULL, p->size * p->per_slab, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) { pthread_mutex_unlock(&p->mu); return; }
+        for (size_t i = p->per_slab; i-- > 0; ) {
+            pool_obj *o = (pool_obj*)(m + i * p->size);
+            o->next = p->depot;
+            p->depot = o;
+        }
+        atomic_fetch_add_explicit(&p->slabs, 1, memory_order_relaxed);
+    }
+    while (p->depot && tc->n < POOL_BATCH) {
+        pool_obj *o = p->depot;
+        p->depot = o->next;
+        o->next = tc->head;
+        tc->head = o;
+        tc->n++;
+    }
+    pthread_mutex_unlock(&p->mu);
+}
+
+// NULL si no queda memoria. El contenido no está inicializado.
+static inline void *pool_get(pool *p, pool_cache *tc) {
+    if (!tc->head) pool_refill(p, tc);
+    pool_obj *o = tc->head;
+    if (!o) return NULL;
+    tc->head = o->next;
+    tc->n--;
+    atomic_fetch_add_explicit(&p->in_use, 1, memory_order_relaxed);
+    return o;
+}
+
+static inline void pool_put(pool *p, pool_cache *tc, void *obj) {
+    pool_obj *o = (pool_obj*)obj;
+    o->next = tc->head;
+    tc->head = o;
+    tc->n++;
+    atomic_fetch_sub_explicit(&p->in_use, 1, memory_order_relaxed);
+    if (tc->n <= POOL_CACHE) return;
+    pthread_mutex_lock(&p->mu);
+    while (tc->n > POOL_CACHE - POOL_BATCH) {
+        o = tc->head;
+        tc->head = o->next;
+        tc->n--;
+        o->next = p->depot;
+        p->depot = o;
+    }
+    pthread_mutex_unlock(&p->mu);
+}
+
+static inline size_t pool_in_use(pool *p) { return atomic_load_explicit(&p->in_use, memory_order_relaxed); }
+static inline size_t pool_reserved(pool *p) {
+    return atomic_load_explicit(&p->slabs, memory_order_relaxed) * p->per_slab;
+}
+
+#endif
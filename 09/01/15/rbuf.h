@@ -0,0 +1,116 @@
+// rbuf.h
+// Buffer de entrada por conexión (ventana deslizante) compartido por server.c y client.c.
+// - Un solo recv() llena tantos bytes como quepan; las líneas se buscan con memchr()
+//   (glibc ya la implementa con SSE2/AVX2), en lugar de un recv() por byte.
+// - Entrega líneas completas y, sin cambiar de objeto, bytes crudos (contenido de FILE).
+// - Varios comandos llegados en un mismo segmento TCP quedan en el buffer para la siguiente llamada.
+
+#ifndef RBUF_H
+#define RBUF_H
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+typedef struct {
+    char *data;      // almacenamiento de cap + 1 bytes (el extra es para el '\0' final)
+    size_t cap;
+    size_t start;    // primer byte sin consumir
+    size_t end;      // fin de los datos válidos
+} rbuf;
+
+static inline void rbuf_init(rbuf *b, char *mem, size_t memsz) {
+    b->data = mem; b->cap = memsz - 1; b->start = b->end = 0;
+}
+static inline size_t rbuf_len(const rbuf *b) { return b->end - b->start; }
+static inline char *rbuf_peek(const rbuf *b) { return b->data + b->start; }
+static inline void rbuf_consume(rbuf *b, size_t n) {
+    b->start += n;
+    if (b->start == b->end) b->start = b->end = 0;
+}
+
+// Un recv() sobre el espacio libre (compacta antes si hace falta). Mismo retorno que recv().
+static inline ssize_t rbuf_fill(rbuf *b, int fd) {
+    if (b->end == b->cap && b->start > 0) {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start; b->start = 0;
+    }
+    if (b->end == b->cap) { errno = ENOBUFS; return -1; }
+    for (;;) {
+        ssize_t r = recv(fd, b->data + b->end, b->cap - b->end, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r > 0) b->end += (size_t)r;
+        return r;
+    }
+}
+
+// Copia hasta n bytes ya recibidos por otra vía (io_uring) al espacio libre, compactando
+// antes si hace falta. Devuelve cuántos cupieron (0 con el buffer lleno).
+static inline size_t rbuf_put(rbuf *b, const void *src, size_t n) {
+    if (b->start > 0 && b->end + n > b->cap) {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start; b->start = 0;
+    }
+    if (n > b->cap - b->end) n = b->cap - b->end;
+    memcpy(b->data + b->end, src, n);
+    b->end += n;
+    return n;
+}
+
+// Siguiente línea completa ya en el buffer, terminada en '\0' (el '\n' se sustituye)
+// y consumida. Si el buffer está lleno sin '\n' se entrega entera, como hacía read_line().
+// El puntero apunta dentro del buffer: es válido hasta el siguiente rbuf_fill().
+static inline char *rbuf_line(rbuf *b, size_t *len) {
+    char *s = b->data + b->start;
+    size_t avail = b->end - b->start;
+    char *nl = (char*)memchr(s, '\n', avail);
+    size_t n;
+    if (nl) n = (size_t)(nl - s);
+    else if (avail == b->cap) n = avail;
+    else return NULL;
+    s[n] = '\0';
+    b->start += nl ? n + 1 : n;
+    if (b->start == b->end) b->start = b->end = 0;
+    if (len) *len = n;
+    return s;
+}
+
+// Equivalente bloqueante del antiguo read_line(): copia la línea con su '\n' en buf.
+// Devuelve la longitud, 0 si el otro extremo cerró sin datos, -1 en error.
+static inline ssize_t rbuf_read_line(rbuf *b, int fd, char *buf, size_t maxlen) {
+    int eof = 0;
+    for (;;) {
+        size_t avail = rbuf_len(b);
+        char *s = rbuf_peek(b);
+        char *nl = (char*)memchr(s, '\n', avail);
+        size_t n = nl ? (size_t)(nl - s) + 1 : avail;
+        if (n > maxlen - 1) n = maxlen - 1;
+        if (nl || n == maxlen - 1 || avail == b->cap || eof) {
+            if (n == 0) return 0;
+            memcpy(buf, s, n); buf[n] = '\0';
+            rbuf_consume(b, n);
+            return (ssize_t)n;
+        }
+        ssize_t r = rbuf_fill(b, fd);
+        if (r == 0) eof = 1;
+        else if (r < 0) return -1;
+    }
+}
+
+// Lectura cruda de n bytes: primero lo que quede en el buffer, el resto directo del socket.
+static inline ssize_t rbuf_read_n(rbuf *b, int fd, void *dst, size_t n) {
+    size_t total = rbuf_len(b) < n ? rbuf_len(b) : n;
+    memcpy(dst, rbuf_peek(b), total);
+    rbuf_consume(b, total);
+    while (total < n) {
+        ssize_t r = recv(fd, (char*)dst + total, n - total, 0);
+        if (r == 0) return 0;
+        if (r < 0) { if (errno == EINTR) continue; return -1; }
+        total += (size_t)r;
+    }
+    return (ssize_t)total;
+}
+
+#endif
@@ -2,6 +2,57 @@
 // Servidor TCP con login (CSV), múltiples clientes (fork + pthread), chat simple y recepción de archivos.
 // - Imprime en consola los mensajes recibidos (usuario, IP:puerto y contenido).
 // - Guarda archivos enviados por el cliente en ./uploads/.
+// - Modos de servidor (-m/--mode):
+//     fork  : un proceso hijo + pthread por conexión (por defecto).
+//     epoll : un solo proceso con epoll edge-triggered y sockets no bloqueantes;
+//             con -w N, N hilos worker cada uno con su listener SO_REUSEPORT y su epoll.
+//     uring : como epoll, pero cada worker hace la E/S por colas de io_uring (uring.h):
+//             accept multishot, recv con buffers provistos por el kernel, recv -> write
+//             enlazados para el contenido de FILE y los envíos de toda una vuelta del
+//             bucle en una sola llamada a io_uring_enter().
+//   Todos ejecutan la misma máquina de estados por conexión (AUTH -> chat/FILE -> salir).
+// - Los FILE se reciben con splice() socket -> pipe -> fichero (sin copiar a espacio de usuario).
+// - El log de eventos es asíncrono (alog.h): anillo acotado + hilo escritor con writev().
+// - users.csv se mantiene en memoria (tabla hash) y se recarga solo al cambiar en disco.
+//   Formato: usuario,contraseña[,rol]; con rol "admin" el usuario puede pedir STATS.
+// - Subidas reanudables y por rangos en paralelo: UPLOAD / UPQUERY / CHUNK / UPDONE.
+// - FILEZ <nombre> <bytes>: subida comprimida por bloques (lz.h), descomprimida al vuelo.
+// - FILE/FILEZ admiten un CRC32C opcional (crc32c.h, SSE4.2): se calcula sobre lo recibido
+//   y FILE_OK devuelve el resultado; si no coincide, FILE_ERR crc y el archivo se borra.
+// - Con --dedup, almacén direccionado por contenido (uploads/.store/<sha256>): los nombres
+//   son enlaces a los blobs y "HAVE <sha256> <bytes> <nombre>" evita reenviar lo que ya está.
+// - GET <nombre> [offset len]: descarga de uploads/ (entera o un rango) con sendfile(); una
+//   caché de descriptores por hilo evita el open()/stat() en cada petición de un archivo caliente.
+// - Tras AUTH_OK el cliente puede pedir "BINARY": tramas tipo + longitud (frame.h) en lugar
+//   de líneas de texto. El texto sigue siendo el modo por defecto.
+// - Salas (-m epoll o uring): JOIN <sala> / LEAVE / ROOMS. Un mensaje de sala se codifica una
+//   vez en un buffer con contador de referencias que comparten las colas de salida de todos
+//   los miembros; cada worker recibe los suyos por un buzón y los envía juntos con writev().
+// - Cola de salida acotada por conexión: por encima de --out-high deja de leerla hasta bajar
+//   de --out-low; a quien se queda atrás (--out-max, o más de --slow-grace s por encima)
+//   se le desconecta o se le descartan mensajes de sala según --slow-policy.
+// - Plazos por conexión con una rueda de temporizadores por worker (twheel.h): AUTH
+//   (--auth-timeout), chat sin actividad (--idle-timeout) y transferencias paradas
+//   (--xfer-timeout); al vencer se avisa con "TIMEOUT <motivo>" y se cierra.
+// - Memoria por conexión: el estado sale de un slab (pool.h) y los buffers de entrada y de
+//   respuesta de un pool compartido; una conexión sin datos pendientes no tiene ninguno.
+// - Reinicio en caliente: con SIGUSR2 arranca el binario que haya en disco con los mismos
+//   argumentos y le pasa los listeners (y con --handover-conns las sesiones de chat en
+//   reposo) por un socket Unix con SCM_RIGHTS; el viejo deja de aceptar cuando el nuevo
+//   ya acepta y sale al quedarse sin conexiones.
+// - Escritura de subidas configurable: reserva con fallocate() por tramos según llega un FILE,
+//   escrituras agrupadas y alineadas (--store-mode coalesce) u O_DIRECT (direct), y
+//   --fsync none|end|<N> (cada N MB).
+// - Métricas (contadores + histogramas p50/p99): comando STATS y --stats-file.
+// - WHO [usuario]: quién está conectado en todo el servidor (también entre los hijos de fork),
+//   leído de un directorio de sesiones en memoria compartida (sessdir.h, --max-sessions).
+// - --unix RUTA: además del puerto TCP, un listener AF_UNIX con el mismo protocolo para los
+//   clientes de la misma máquina (sin la pila TCP/IP de loopback).
+// - SENDTO <usuario> <nombre> <bytes> (-m epoll o uring): el contenido pasa del socket del
+//   emisor al del destinatario conectado con splice() a través de un pipe, sin tocar disco;
+//   el destinatario lo recibe como "RELAY <de> <nombre> <bytes>" y el contenido detrás.
+//
+// Compilar: gcc -O2 -Wall -pthread server.c -o server
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -13,6 +64,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <pthread.h>
 #include <signal.h>
 #include <errno.h>
@@ -21,11 +73,40 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <limits.h>
+
+#include "rbuf.h"
+#include "alog.h"
+#include "hist.h"
+#include "frame.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "sha256.h"
+#include "twheel.h"
+#include "pool.h"
+#include "uring.h"
+#include "sessdir.h"
 
 #define PORT 8080
 #define BUFFER_SIZE 4096
 #define CSV_PATH "users.csv"
 #define UPLOAD_DIR "uploads"
+#define STORE_DIR UPLOAD_DIR "/.store"
+#define MAX_EVENTS 256
+#define SPLICE_CHUNK (1 << 20)
+#define FILE_BUF (256 * 1024)      // recv directo del contenido cuando no se usa splice()
+#define IOV_BATCH 64               // segmentos de salida por writev()
+#define IOBUF_SIZE (BUFFER_SIZE + 64)  // buffer del pool: entrada (BUFFER_SIZE + 1) o salida (obuf)
 
 static void rstrip_newline(char *s) {
     size_t n = strlen(s);
@@ -37,42 +118,142 @@ static void trim(char *s) {
     while (q >= p && isspace((unsigned char)*q)) *q-- = '\0';
     if (p != s) memmove(s, p, (size_t)(q - p + 2));
 }
-static ssize_t read_n(int fd, void *buf, size_t n) {
-    size_t total = 0; char *p = (char*)buf;
-    while (total < n) {
-        ssize_t r = recv(fd, p + total, n - total, 0);
-        if (r == 0) return 0;
-        if (r < 0) { if (errno == EINTR) continue; return -1; }
-        total += (size_t)r;
-    }
-    return (ssize_t)total;
-}
-static ssize_t read_line(int fd, char *buf, size_t maxlen) {
-    size_t i = 0;
-    while (i < maxlen - 1) {
-        char c;
-        ssize_t r = recv(fd, &c, 1, 0);
-        if (r == 0) { if (i == 0) return 0; break; }
-        if (r < 0) { if (errno == EINTR) continue; return -1; }
-        buf[i++] = c;
-        if (c == '\n') break;
-    }
-    buf[i] = '\0';
-    return (ssize_t)i;
-}
-static bool check_credentials(const char *user, const char *pass) {
-    FILE *f = fopen(CSV_PATH, "r");
-    if (!f) { perror("No se pudo abrir users.csv"); return false; }
-    char line[1024]; bool ok = false;
+// --- Índice de credenciales en memoria ---
+// users.csv se carga una vez en una tabla hash de direccionamiento abierto (sondeo lineal).
+// Un hilo vigila el mtime del fichero, reconstruye la tabla fuera de línea y la publica
+// con un intercambio de puntero; cada login solo toma una referencia, sin tocar disco.
+typedef struct { char *user; char *pass; bool admin; } cred_entry;
+typedef struct {
+    cred_entry *slots;   // user == NULL => hueco libre
+    size_t mask;         // capacidad - 1 (potencia de 2)
+    size_t count;
+    int refs;            // protegido por cred_mu
+} cred_table;
+
+static pthread_mutex_t cred_mu = PTHREAD_MUTEX_INITIALIZER;
+static cred_table *cred_cur = NULL;
+
+static uint64_t hash_str(const char *s) {
+    uint64_t h = 1469598103934665603ULL;                 // FNV-1a
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ULL; }
+    return h;
+}
+static void cred_free(cred_table *t) {
+    for (size_t i = 0; i <= t->mask; i++) { free(t->slots[i].user); free(t->slots[i].pass); }
+    free(t->slots); free(t);
+}
+static cred_entry *cred_slot(const cred_table *t, const char *user) {
+    size_t i = (size_t)hash_str(user) & t->mask;
+    while (t->slots[i].user && strcmp(t->slots[i].user, user) != 0) i = (i + 1) & t->mask;
+    return &t->slots[i];
+}
+static int cred_grow(cred_table *t) {
+    size_t ncap = (t->mask + 1) * 2;
+    cred_entry *old = t->slots; size_t oldcap = t->mask + 1;
+    t->slots = (cred_entry*)calloc(ncap, sizeof(cred_entry));
+    if (!t->slots) { t->slots = old; return -1; }
+    t->mask = ncap - 1;
+    for (size_t i = 0; i < oldcap; i++) if (old[i].user) *cred_slot(t, old[i].user) = old[i];
+    free(old);
+    return 0;
+}
+// Si un usuario aparece repetido se queda la primera fila.
+static int cred_insert(cred_table *t, const char *user, const char *pass, bool admin) {
+    if ((t->count + 1) * 2 > t->mask + 1 && cred_grow(t) != 0) return -1;
+    cred_entry *e = cred_slot(t, user);
+    if (e->user) return 0;
+    e->user = strdup(user); e->pass = strdup(pass); e->admin = admin;
+    if (!e->user || !e->pass) { free(e->user); free(e->pass); e->user = e->pass = NULL; return -1; }
+    t->count++;
+    return 0;
+}
+static cred_table *cred_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror("No se pudo abrir users.csv"); return NULL; }
+    cred_table *t = (cred_table*)calloc(1, sizeof(cred_table));
+    if (t) { t->mask = 63; t->slots = (cred_entry*)calloc(t->mask + 1, sizeof(cred_entry)); }
+    if (!t || !t->slots) { free(t); fclose(f); return NULL; }
+    char line[1024];
     while (fgets(line, sizeof(line), f)) {
         if (line[0] == '#' || line[0] == '\n') continue;
         char *p = strchr(line, ','); if (!p) continue;
         *p = '\0';
         char *csv_user = line; char *csv_pass = p + 1;
-        rstrip_newline(csv_pass); trim(csv_user); trim(csv_pass);
-        if (strcmp(csv_user, user) == 0 && strcmp(csv_pass, pass) == 0) { ok = true; break; }
+        rstrip_newline(csv_pass);
+        char *csv_role = strchr(csv_pass, ',');     // tercera columna opcional: rol
+        if (csv_role) { *csv_role++ = '\0'; trim(csv_role); }
+        trim(csv_user); trim(csv_pass);
+        bool admin = csv_role && strcasecmp(csv_role, "admin") == 0;
+        if (cred_insert(t, csv_user, csv_pass, admin) != 0) { cred_free(t); fclose(f); return NULL; }
+    }
+    fclose(f);
+    t->refs = 1;   // referencia de cred_cur
+    return t;
+}
+static cred_table *cred_acquire(void) {
+    pthread_mutex_lock(&cred_mu);
+    cred_table *t = cred_cur;
+    if (t) t->refs++;
+    pthread_mutex_unlock(&cred_mu);
+    return t;
+}
+static void cred_release(cred_table *t) {
+    pthread_mutex_lock(&cred_mu);
+    bool last = (--t->refs == 0);
+    pthread_mutex_unlock(&cred_mu);
+    if (last) cred_free(t);
+}
+static void cred_publish(cred_table *t) {
+    pthread_mutex_lock(&cred_mu);
+    cred_table *old = cred_cur;
+    cred_cur = t;
+    pthread_mutex_unlock(&cred_mu);
+    if (old) cred_release(old);
+}
+static bool check_credentials(const char *user, const char *pass, bool *admin) {
+    cred_table *t = cred_acquire();
+    if (!t) return false;
+    cred_entry *e = cred_slot(t, user);
+    bool ok = e->user && strcmp(e->pass, pass) == 0;
+    *admin = ok && e->admin;
+    cred_release(t);
+    return ok;
+}
+
+// Recarga en segundo plano cuando cambia users.csv (mtime, tamaño o inodo).
+static bool same_file_version(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+static void *cred_reload_thread(void *arg) {
+    struct stat seen = *(struct stat*)arg;
+    free(arg);
+    while (1) {
+        sleep(1);
+        struct stat st;
+        if (stat(CSV_PATH, &st) != 0 || same_file_version(&st, &seen)) continue;
+        seen = st;
+        cred_table *t = cred_load(CSV_PATH);
+        if (!t) continue;   // se mantiene la tabla anterior
+        alog("[USUARIOS] %s recargado (%zu usuarios)\n", CSV_PATH, t->count);
+        cred_publish(t);
     }
-    fclose(f); return ok;
+    return NULL;
+}
+static void cred_atfork_prepare(void) { pthread_mutex_lock(&cred_mu); }
+static void cred_atfork_release(void) { pthread_mutex_unlock(&cred_mu); }
+
+static void cred_init(void) {
+    struct stat *st = (struct stat*)calloc(1, sizeof(struct stat));
+    if (!st) return;
+    stat(CSV_PATH, st);
+    cred_table *t = cred_load(CSV_PATH);
+    if (t) cred_publish(t);
+    // Los hijos de fork heredan la tabla sin quedarse con cred_mu bloqueado
+    pthread_atfork(cred_atfork_prepare, cred_atfork_release, cred_atfork_release);
+    pthread_t th;
+    if (pthread_create(&th, NULL, cred_reload_thread, st) != 0) { perror("pthread_create"); free(st); return; }
+    pthread_detach(th);
 }
 static void sanitize_filename(const char *in, char *out, size_t outsz) {
     const char *base = strrchr(in, '/');
@@ -94,180 +275,3414 @@ static int ensure_upload_dir(void) {
     if (stat(UPLOAD_DIR, &st) == 0) return S_ISDIR(st.st_mode) ? 0 : -1;
     return (mkdir(UPLOAD_DIR, 0755) == -1 && errno != EEXIST) ? -1 : 0;
 }
-static int receive_file(int sock, const char *name, long long size, const char *who, const char *ipport) {
-    if (size < 0) return -1;
-    if (ensure_upload_dir() != 0) return -1;
 
-    char safe[256]; sanitize_filename(name, safe, sizeof(safe));
-    char path[512]; snprintf(path, sizeof(path), "%s/%s", UPLOAD_DIR, safe);
-    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
-    if (fd < 0) return -1;
+// --- Cola de salida ---
+// Lista de segmentos sobre buffers con contador de referencias. Las respuestas propias de
+// una conexión se van añadiendo a su último buffer privado; un mensaje de sala es un único
+// buffer que aparece en la cola de cada miembro (sin copiar la carga por destinatario).
+typedef struct {
+    atomic_int refs;
+    bool priv;                     // de una sola conexión: se le puede añadir detrás
+    bool pooled;                   // de buf_pool (los que caben en IOBUF_SIZE)
+    size_t len, cap;
+    char data[];
+} obuf;
 
-    char buf[BUFFER_SIZE];
-    long long remaining = size;
-    while (remaining > 0) {
-        size_t chunk = (remaining > (long long)sizeof(buf)) ? sizeof(buf) : (size_t)remaining;
-        ssize_t r = read_n(sock, buf, chunk);
-        if (r <= 0) { close(fd); return -1; }
-        if (write(fd, buf, (size_t)r) != r) { close(fd); return -1; }
-        remaining -= r;
-    }
-    close(fd);
-    printf("[ARCHIVO] %s@%s -> %s (%lld bytes)\n", who, ipport, path, size);
-    fflush(stdout);
-    return 0;
+typedef struct oseg {
+    obuf *b;
+    size_t off;                    // bytes de b ya enviados
+    void *to;                      // en un buzón: client_ctx destino
+    struct oseg *next;
+} oseg;
+
+// Buffers de E/S compartidos por todas las conexiones (y todos los hilos)
+static pool buf_pool = POOL_INIT("buffers", IOBUF_SIZE, 256);
+static __thread pool_cache buf_tc;
+
+static obuf *obuf_new(size_t cap, bool priv) {
+    bool pooled = sizeof(obuf) + cap <= buf_pool.size;
+    obuf *b = pooled ? (obuf*)pool_get(&buf_pool, &buf_tc) : (obuf*)malloc(sizeof(obuf) + cap);
+    if (!b) return NULL;
+    atomic_init(&b->refs, 1);
+    b->priv = priv; b->pooled = pooled; b->len = 0;
+    b->cap = pooled ? buf_pool.size - sizeof(obuf) : cap;
+    return b;
+}
+static void obuf_put(obuf *b) {
+    if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) != 1) return;
+    if (b->pooled) pool_put(&buf_pool, &buf_tc, b);
+    else free(b);
 }
 
+// -m uring: anillo de un worker y sus buffers provistos para recv
 typedef struct {
-    int sock;
-    struct sockaddr_in addr;
-    char user[256];
-} client_ctx;
+    uring ring;
+    uring_bufs bufs;
+    bool starved;                  // alguna conexión se quedó sin buffer (ENOBUFS)
+} worker_ring;
 
-static void now_str(char *out, size_t n) {
-    time_t t = time(NULL); struct tm tm; localtime_r(&t, &tm);
-    strftime(out, n, "%Y-%m-%d %H:%M:%S", &tm);
+// --- Shards (modo epoll/uring con --workers N) ---
+// Cada worker tiene su propio listener SO_REUSEPORT y su propio bucle epoll; el kernel
+// reparte las conexiones entrantes. Los contadores solo los escribe su hilo.
+typedef struct {
+    int id;
+    int listen_fd;
+    int cpu;                       // -1 sin fijar
+    pthread_t th;
+    atomic_ulong accepted, active;
+    atomic_ullong bytes_in, bytes_out;
+    // Buzón: segmentos de sala para conexiones de este worker, dejados por cualquier hilo
+    pthread_mutex_t mb_mu;
+    oseg *mb_head, *mb_tail;
+    int mb_fd;                     // eventfd que despierta al worker
+    oseg **stage_head, **stage_tail;   // al difundir desde este worker: uno por worker destino
+    twheel tw;                     // plazos de sus conexiones (solo lo toca su hilo)
+    int ep;                        // su epoll
+    worker_ring *ur;               // -m uring: su anillo (NULL en epoll)
+    atomic_ullong ur_enters, ur_cqes;  // io_uring_enter() y completions, para SIGUSR1
+    struct client_ctx *conns;      // sus conexiones (para entregarlas en un relevo)
+    struct hr_conn *adopt;         // relevo: sesiones recibidas del anterior (con mb_mu)
+    struct relay *rl_offers;       // SENDTO: reenvíos para conexiones de este worker (con mb_mu)
+    struct relay *rl_put[2];       // reenvíos que soltó en esta vuelta del bucle (por lado)
+    bool drained;                  // relevo: ya cerró su listener
+    atomic_ulong timers;           // temporizadores armados, para SIGUSR1
+} worker;
+
+static int nworkers = 1;
+static worker *workers = NULL;
+
+static void shard_add(atomic_ullong *ctr, ssize_t n) {
+    if (n > 0) atomic_fetch_add_explicit(ctr, (unsigned long long)n, memory_order_relaxed);
 }
 
-static void *client_thread(void *arg) {
-    client_ctx *ctx = (client_ctx*)arg;
-    int sock = ctx->sock;
-    char line[BUFFER_SIZE];
+// --- Métricas ---
+// Contadores e histogramas repartidos en MET_SHARDS bloques según el id del hilo, así cada
+// worker (o hijo de fork) escribe casi siempre en su propio bloque. Viven en memoria
+// compartida para que STATS y el volcado periódico vean también a los hijos de fork.
+#define MET_SHARDS 64
+enum { M_CONNS, M_SESSIONS, M_AUTH_OK, M_AUTH_FAIL, M_MSGS, M_FILES, M_FILE_ERR, M_UPLOAD_BYTES,
+       M_DEDUP_HITS, M_DEDUP_BYTES, M_GETS, M_GET_BYTES, M_FDC_HITS, M_ROOM_MSGS, M_ROOM_DELIVERIES,
+       M_OUT_PAUSES, M_SLOW_EVICT, M_ROOM_DROPS, M_TIMEOUTS, M_RELAYS, M_RELAY_BYTES, M_NCOUNTERS };
+static const char *met_counter_names[M_NCOUNTERS] = {
+    "conexiones", "sesiones_activas", "auth_ok", "auth_fail", "mensajes", "archivos", "archivos_error", "bytes_subidos",
+    "dedup_have", "bytes_no_enviados", "descargas", "bytes_descargados", "cache_fd_aciertos",
+    "mensajes_sala", "entregas_sala", "pausas_lectura", "lentos_desconectados", "sala_descartados",
+    "timeouts", "reenvios", "bytes_reenviados"
+};
+enum { H_AUTH_NS, H_MSG_NS, H_UPLOAD_US, H_UPLOAD_BYTES, H_WRITE_NS, H_SYNC_NS, H_COMMIT_NS, M_NHIST };
 
-    char ipstr[64]; inet_ntop(AF_INET, &ctx->addr.sin_addr, ipstr, sizeof(ipstr));
-    int cport = ntohs(ctx->addr.sin_port);
-    char ipport[96]; snprintf(ipport, sizeof(ipport), "%s:%d", ipstr, cport);
+typedef struct {
+    atomic_llong c[M_NCOUNTERS];
+    hist h[M_NHIST];
+} met_shard;
 
-    // --- Autenticación ---
-    ssize_t n = read_line(sock, line, sizeof(line));
-    if (n <= 0) goto done;
-    rstrip_newline(line);
+static met_shard *metrics = NULL;
+static __thread met_shard *met_mine = NULL;
 
-    if (strncasecmp(line, "AUTH ", 5) == 0) {
-        char user[256], pass[256];
-        if (sscanf(line + 5, "%255s %255s", user, pass) != 2 || !check_credentials(user, pass)) {
-            send(sock, "AUTH_FAIL\n", 10, 0);
-            goto done;
-        }
-        strncpy(ctx->user, user, sizeof(ctx->user)-1);
-        ctx->user[sizeof(ctx->user)-1] = '\0';
-        send(sock, "AUTH_OK\n", 8, 0);
-        printf("[LOGIN] %s conectado desde %s\n", ctx->user, ipport);
-        fflush(stdout);
-    } else {
-        send(sock, "AUTH_FAIL\n", 10, 0);
-        goto done;
+static int metrics_init(void) {
+    void *p = mmap(NULL, sizeof(met_shard) * MET_SHARDS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) { perror("mmap métricas"); return -1; }
+    metrics = (met_shard*)p;
+    return 0;
+}
+static met_shard *met_self(void) {
+    if (!met_mine) met_mine = &metrics[(unsigned)gettid() % MET_SHARDS];
+    return met_mine;
+}
+static void met_add(int idx, long long n) {
+    if (metrics) atomic_fetch_add_explicit(&met_self()->c[idx], n, memory_order_relaxed);
+}
+static void met_hist(int idx, uint64_t v) {
+    if (metrics) hist_record(&met_self()->h[idx], v);
+}
+static uint64_t mono_ns(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+// Los plazos se cuentan en ticks de 100 ms (la resolución de la rueda)
+#define TICK_NS 100000000ULL
+#define TICKS(sec) ((uint64_t)(sec) * (1000000000ULL / TICK_NS))
+static uint64_t tick_now(void) { return mono_ns() / TICK_NS; }
+static __thread uint64_t loop_tick;    // epoll/uring: tick de la espera en curso
+
+// Suma de todos los bloques en texto, una métrica por línea con el prefijo dado.
+static size_t met_format(char *out, size_t cap, const char *prefix) {
+    static const struct { const char *name; double div; const char *unit; } hd[M_NHIST] = {
+        { "auth", 1000.0, "us" }, { "mensaje", 1000.0, "us" }, { "subida", 1000.0, "ms" }, { "subida_tam", 1.0, "B" },
+        { "escritura", 1000.0, "us" }, { "fsync", 1000.0, "us" }, { "cierre", 1000.0, "us" }
+    };
+    long long c[M_NCOUNTERS] = {0};
+    hist *agg = (hist*)calloc(M_NHIST, sizeof(hist));
+    if (!agg || !metrics) { free(agg); return (size_t)snprintf(out, cap, "%ssin métricas\n", prefix); }
+    for (int s = 0; s < MET_SHARDS; s++) {
+        for (int i = 0; i < M_NCOUNTERS; i++) c[i] += atomic_load_explicit(&metrics[s].c[i], memory_order_relaxed);
+        for (int i = 0; i < M_NHIST; i++) hist_merge(&agg[i], &metrics[s].h[i]);
     }
+    size_t n = (size_t)snprintf(out, cap, "%s", prefix);
+    for (int i = 0; i < M_NCOUNTERS && n < cap; i++)
+        n += (size_t)snprintf(out + n, cap - n, "%s%s=%lld", i ? " " : "", met_counter_names[i], c[i]);
+    if (n < cap) n += (size_t)snprintf(out + n, cap - n, "\n");
+    for (int i = 0; i < M_NHIST && n < cap; i++) {
+        hist *h = &agg[i];
+        n += (size_t)snprintf(out + n, cap - n, "%s%s_%s n=%llu media=%.1f p50=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+                              prefix, hd[i].name, hd[i].unit, atomic_load(&h->count),
+                              (double)hist_mean(h) / hd[i].div,
+                              (double)hist_percentile(h, 50.0) / hd[i].div,
+                              (double)hist_percentile(h, 99.0) / hd[i].div,
+                              (double)hist_percentile(h, 99.9) / hd[i].div,
+                              (double)atomic_load(&h->max) / hd[i].div);
+    }
+    free(agg);
+    return n < cap ? n : cap - 1;
+}
 
-    // --- Bucle de chat/comandos ---
+// Volcado periódico a fichero (escribe en .tmp y renombra: quien lo lea nunca ve medio fichero).
+static const char *stats_path = NULL;
+static int stats_interval = 10;
+
+static void *stats_dump_thread(void *arg) {
+    (void)arg;
+    char tmp[1024]; snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+    char *buf = (char*)malloc(BUFFER_SIZE);
+    if (!buf) return NULL;
     while (1) {
-        n = read_line(sock, line, sizeof(line));
-        if (n == 0) { // desconexión
-            printf("[DESCONECTADO] %s @ %s\n", ctx->user[0] ? ctx->user : "?", ipport);
-            fflush(stdout);
-            break;
-        } else if (n < 0) {
-            perror("recv");
-            break;
-        }
-        rstrip_newline(line);
-        if (line[0] == '\0') continue;
+        sleep((unsigned)stats_interval);
+        size_t n = (size_t)snprintf(buf, BUFFER_SIZE, "# %s\n", alog_now());
+        n += met_format(buf + n, BUFFER_SIZE - n, "");
+        int fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0) continue;
+        bool ok = write(fd, buf, n) == (ssize_t)n;
+        close(fd);
+        if (ok) rename(tmp, stats_path);
+    }
+    return NULL;
+}
 
-        // salir
-        if (strncasecmp(line, "salir", 5) == 0 && (line[5] == '\0' || isspace((unsigned char)line[5]))) {
-            send(sock, "BYE\n", 4, 0);
-            printf("[SALIR] %s @ %s cerró sesión\n", ctx->user, ipport);
-            fflush(stdout);
-            break;
+// --- Caché de descriptores para GET ---
+// Una por hilo (cada worker epoll, o el hilo del hijo en modo fork): sin cerrojos. Un archivo
+// de uploads/ nunca se reescribe en su sitio (start_file borra antes de crear; UPDONE y el
+// almacén usan rename), así que un fd abierto no cambia por debajo: basta con repetir el
+// stat() del nombre cada FDC_TTL_NS para ver si ahora apunta a otro inodo.
+#define FDC_SLOTS 64
+#define FDC_TTL_NS 1000000000ULL
+
+typedef struct {
+    char name[256];                // "" = libre
+    int fd;
+    int refs;                      // descargas en curso con este fd: no se puede cerrar
+    dev_t dev;
+    ino_t ino;
+    long long size;
+    uint64_t checked;              // último stat() del nombre
+    uint64_t used;                 // última petición (para desalojar la más antigua)
+} fd_entry;
+
+static __thread fd_entry fdc[FDC_SLOTS];
+
+static void fdc_drop(fd_entry *e) { close(e->fd); e->name[0] = '\0'; }
+
+// fd de uploads/<name> (ya saneado) y su tamaño. *ent es la entrada de la caché, con una
+// referencia más, o NULL si el fd es propio y hay que cerrarlo al terminar. -1 si no hay archivo.
+static int fdc_open(const char *name, long long *size, fd_entry **ent) {
+    char path[512]; snprintf(path, sizeof(path), "%s/%s", UPLOAD_DIR, name);
+    uint64_t now = mono_ns();
+    struct stat st;
+    fd_entry *e = NULL, *victim = NULL;
+    for (int i = 0; i < FDC_SLOTS; i++) {
+        fd_entry *s = &fdc[i];
+        if (s->name[0] && strcmp(s->name, name) == 0) { e = s; break; }
+        if (s->refs == 0 && (!victim || (victim->name[0] && (!s->name[0] || s->used < victim->used)))) victim = s;
+    }
+    if (e && now - e->checked > FDC_TTL_NS) {
+        if (stat(path, &st) == 0 && st.st_dev == e->dev && st.st_ino == e->ino) {
+            e->size = (long long)st.st_size;           // mismo inodo (quizá aún subiéndose)
+            e->checked = now;
+        } else if (e->refs == 0) {
+            fdc_drop(e); victim = e; e = NULL;
+        } else {
+            e = NULL; victim = NULL;                   // el viejo sigue en uso: fd propio
         }
+    }
+    if (e) {
+        e->refs++; e->used = now;
+        met_add(M_FDC_HITS, 1);
+        *size = e->size; *ent = e;
+        return e->fd;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { close(fd); return -1; }
+    *size = (long long)st.st_size; *ent = NULL;
+    if (victim) {
+        if (victim->name[0]) fdc_drop(victim);
+        snprintf(victim->name, sizeof(victim->name), "%s", name);
+        victim->fd = fd; victim->refs = 1;
+        victim->dev = st.st_dev; victim->ino = st.st_ino; victim->size = *size;
+        victim->checked = victim->used = now;
+        *ent = victim;
+    }
+    return fd;
+}
+
+// Estados de la máquina por conexión
+enum { ST_AUTH, ST_CHAT, ST_FILE, ST_RELAY, ST_CLOSE };
+
+struct room;
+struct relay;
+enum { RL_PENDING, RL_DONE, RL_FAILED, RL_BUSY };   // resultado de un reenvío (SENDTO)
+
+// FILE / FILEZ / CHUNK en curso
+typedef struct {
+    int fd;                        // -1 si se está descartando el contenido
+    long long size, left;
+    long long off;                 // siguiente offset a escribir (pwrite)
+    long long chunk_start;         // CHUNK: offset inicial del rango
+    char id[65];                   // CHUNK en curso de una subida reanudable, "" para FILE
+    char name[256];
+    char path[512];
+    struct timespec t0;
+    long long spliced;             // bytes que llegaron por splice() (uring: recv + write enlazados)
+    bool splice_off;               // splice() no soportado en esta conexión
+    char *fbuf;                    // FILE_BUF bytes mientras dura un FILE por copia
+    char *wbuf;                    // --store-mode coalesce/direct: store_buf bytes alineados
+    size_t wb_len;                 // bytes en wbuf, que van en el fichero a partir de wb_off
+    long long wb_off;
+    bool wb_direct;                // fichero con O_DIRECT
+    long long unsynced;            // bytes escritos desde el último fdatasync()
+    long long pa_end, pa_lim;      // FILE: reservado con fallocate() hasta pa_end, como mucho pa_lim
+    uint32_t crc;                  // CRC32C de lo que pasó por espacio de usuario
+    bool crc_want;                 // el cliente mandó su CRC: sin splice, para poder calcularlo
+    uint32_t crc_expect;
+    bool sha_on;                   // --dedup: SHA-256 del contenido para el almacén (sin splice)
+    sha256_ctx sha;
+    unsigned char *zbuf;           // FILEZ: bloque en curso (LZ_HDR + datos) y salida; NULL si FILE normal
+    size_t zhave;                  // bytes del bloque en curso ya recibidos
+    long long zwire;               // bytes comprimidos recibidos (para el ratio)
+} upload_state;
+
+// Sala de la conexión
+typedef struct {
+    struct room *room;             // NULL fuera de sala
+    int idx;                       // posición en room->members (protegida por room->mu)
+    bool roomed;                   // estuvo en alguna sala: puede tener segmentos en el buzón
+} room_state;
+
+// -m uring: la conexión no se libera hasta que vuelvan todas sus operaciones
+typedef struct {
+    uint8_t in, out;               // en curso: recv (o recv + write enlazados) y envío
+    bool dead;                     // ya cerrada: solo se esperan sus completions
+    bool starved;                  // su recv no encontró buffer provisto (ENOBUFS)
+    int bid;                       // buffer provisto aún sin procesar (entrada bloqueada), -1 si no
+    unsigned boff, blen;
+    unsigned want;                 // FILE por copia: bytes recibidos en fbuf que escribe el write
+    long long pipe;                // GET: bytes en el pipe aún por enviar
+    void *msg;                     // msghdr + iovecs del envío en curso (de buf_pool)
+} ur_state;
+
+// Reinicio en caliente
+typedef struct {
+    bool handoff;                  // entregada al sucesor: no tocar el socket al cerrar
+} hr_state;
+
+// SENDTO (epoll/uring): reenvío directo a otro usuario
+typedef struct {
+    struct relay *src;             // emisor: el reenvío al que va su contenido (NULL: se descarta)
+    long long left;                // emisor: bytes del contenido aún por llegar (ST_RELAY)
+    bool wait;                     // emisor: todo en el pipe, esperando el resultado del receptor
+    struct relay *dst;             // receptor: el contenido sale del pipe en lugar de un GET
+    bool busy;                     // receptor con un reenvío ofrecido o en curso (con online_mu)
+    bool online;                   // en la lista de sesiones a las que se puede enviar (online_mu)
+    struct client_ctx *on_prev, *on_next;
+} relay_state;
+
+typedef struct client_ctx {
+    int sock;
+    char user[256];
+    char ipport[96];
+    bool admin;                    // rol "admin" en users.csv: puede usar STATS
+    int state;
+    bool nonblock;                 // modo epoll: lo que no se pueda enviar espera a EPOLLOUT
+    bool binary;                   // tramas de frame.h tras "BINARY"
+    bool corked;                   // procesando un lote de entrada: respuestas en out, un solo envío
+    worker *shard;                 // NULL en modo fork
+    // Entrada pendiente de procesar (líneas o contenido de FILE); el buffer es de buf_pool
+    // y solo está puesto mientras queda algo sin procesar (in.data == NULL si no)
+    rbuf in;
+    // Salida pendiente
+    oseg *oq_head, *oq_tail;
+    int oq_n;                      // segmentos en la cola
+    size_t oq_bytes;               // bytes sin enviar en la cola (el contenido de un GET no cuenta)
+    bool paused;                   // cola por encima de out_high: no se lee hasta bajar de out_low
+    uint64_t over_since;           // mono_ns() al pasar de out_high
+    bool evicted;                  // desconectado por lento: lo que llegue se descarta
+    // Plazos (en ticks): se calculan al vencer el temporizador, no en cada lectura
+    tw_timer tmr;                  // epoll: en la rueda del worker
+    uint64_t t_accept, last_in, last_out;
+    upload_state up;               // FILE en curso
+    int pipefd[2];                 // socket -> pipe -> fichero o GET (zero-copy), -1 si no hay
+    // GET en curso: el contenido sale con sendfile() detrás de los get_before primeros segmentos
+    int get_fd;                    // -1 si no hay descarga
+    fd_entry *get_ent;             // entrada de la caché o NULL si get_fd es propio
+    off_t get_off;
+    long long get_left;
+    int get_before;
+    room_state rm;                 // salas
+    bool mb_dirty;                 // recibió segmentos en el vaciado de buzón en curso
+    struct client_ctx *mb_next;
+    struct client_ctx *w_prev, *w_next;    // en shard->conns
+    ur_state ur;                   // -m uring
+    sd_slot *dslot;                // su hueco en el directorio de sesiones (WHO), NULL si no tiene
+    relay_state rl;                // SENDTO
+    hr_state hr;                   // reinicio en caliente
+} client_ctx;
+
+// Slab de conexiones: cada worker reutiliza las suyas sin pasar por malloc()
+static pool ctx_pool = POOL_INIT("conexiones", sizeof(client_ctx), 64);
+static __thread pool_cache ctx_tc;
+
+static bool zerocopy = true;       // --no-zerocopy fuerza la copia por el buffer de usuario
+static const char *unix_path = NULL;   // --unix: también se escucha en este socket AF_UNIX
+static int unix_fd = -1;               // su listener, compartido por todos los workers
+static atomic_ulong unix_conns;        // conexiones aceptadas en él, para distinguirlas (ipport)
+// Contrapresión de la cola de salida (ver ctx_out_check)
+enum { SLOW_CLOSE, SLOW_DROP };
+static size_t out_high = 256 * 1024, out_low = 0, out_max = 0;     // 0: derivados de out_high
+static int slow_grace = 10;        // segundos por encima de out_high antes de desconectar
+static int slow_policy = SLOW_CLOSE;
+static int auth_timeout = 10, idle_timeout = 300, xfer_timeout = 30;   // segundos, 0 = sin plazo
+static bool dedup = false;         // --dedup: almacén direccionado por contenido
+// Escritura de subidas (ver file_write)
+enum { STORE_PLAIN, STORE_COALESCE, STORE_DIRECT };
+static const char *store_names[] = { "plain", "coalesce", "direct" };
+static int store_mode = STORE_PLAIN;
+static size_t store_buf = 1 << 20;     // --store-buf: tamaño de cada escritura agrupada
+static bool prealloc = true;           // --no-prealloc
+static long long fsync_every = 0;      // --fsync: 0 nunca, -1 al final, >0 cada tantos bytes
+static sessdir sessions;               // directorio compartido por todos los procesos (WHO)
+static unsigned max_sessions = 4096;   // --max-sessions: huecos del directorio
+
+static const char *ctx_user(const client_ctx *c) { return c->user[0] ? c->user : "?"; }
+// Tráfico de la conexión: en los contadores de su worker y en su hueco del directorio
+static void ctx_bytes_in(client_ctx *c, ssize_t n) {
+    if (c->shard) shard_add(&c->shard->bytes_in, n);
+    if (c->dslot) shard_add(&c->dslot->bytes_in, n);
+}
+static void ctx_bytes_out(client_ctx *c, ssize_t n) {
+    if (c->shard) shard_add(&c->shard->bytes_out, n);
+    if (c->dslot) shard_add(&c->dslot->bytes_out, n);
+}
+static uint64_t ctx_tick(const client_ctx *c) { return c->nonblock ? loop_tick : tick_now(); }
+
+// family: la del listener que la aceptó. addr: la que devolvió accept(), o NULL para pedírsela
+// al socket (multishot, sesiones heredadas).
+static client_ctx *ctx_new(int sock, int family, const struct sockaddr_storage *addr, bool nonblock) {
+    client_ctx *c = (client_ctx*)pool_get(&ctx_pool, &ctx_tc);
+    if (!c) return NULL;
+    memset(c, 0, sizeof(*c));
+    c->sock = sock; c->nonblock = nonblock;
+    c->state = ST_AUTH; c->up.fd = -1; c->get_fd = -1;
+    c->pipefd[0] = c->pipefd[1] = -1;
+    c->ur.bid = -1;
+    c->t_accept = c->last_in = c->last_out = ctx_tick(c);
+    met_add(M_CONNS, 1);
+    if (family == AF_UNIX) {
+        // --unix: el cliente no tiene dirección; su pid (SO_PEERCRED) y el número de conexión
+        struct ucred cr = { 0 }; socklen_t crlen = sizeof(cr);
+        getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cr, &crlen);
+        snprintf(c->ipport, sizeof(c->ipport), "unix:%d#%lu", (int)cr.pid, atomic_fetch_add(&unix_conns, 1) + 1);
+        return c;
+    }
+    struct sockaddr_storage peer;
+    if (!addr) {
+        socklen_t alen = sizeof(peer);
+        memset(&peer, 0, sizeof(peer));
+        getpeername(sock, (struct sockaddr*)&peer, &alen);
+        addr = &peer;
+    }
+    const struct sockaddr_in *in = (const struct sockaddr_in*)addr;
+    char ipstr[64]; inet_ntop(AF_INET, &in->sin_addr, ipstr, sizeof(ipstr));
+    snprintf(c->ipport, sizeof(c->ipport), "%s:%d", ipstr, ntohs(in->sin_port));
+    return c;
+}
+static void relay_src_end(client_ctx *c);
+static void relay_dst_end(client_ctx *c, struct relay *rl, int res);
+static void relay_dst_tick(client_ctx *c);
+static void get_end(client_ctx *c) {
+    if (c->get_fd < 0) return;
+    if (c->rl.dst) {                   // SENDTO: entregado si salió entero
+        relay_dst_end(c, c->rl.dst, c->get_left == 0 ? RL_DONE : RL_FAILED);
+        c->rl.dst = NULL;
+    } else if (c->get_ent) c->get_ent->refs--;
+    else close(c->get_fd);
+    c->get_fd = -1; c->get_ent = NULL; c->get_left = 0;
+}
+static void conn_link(worker *w, client_ctx *c) {
+    c->w_prev = NULL; c->w_next = w->conns;
+    if (w->conns) w->conns->w_prev = c;
+    w->conns = c;
+}
+static void file_unreserve(client_ctx *c);
+// Lo que queda al cerrar: colas, ficheros, buffers y el propio socket.
+static void ctx_release(client_ctx *c) {
+    if (c->shard) tw_cancel(&c->shard->tw, &c->tmr);
+    for (oseg *s = c->oq_head, *next; s; s = next) { next = s->next; obuf_put(s->b); free(s); }
+    if (c->rl.src) relay_src_end(c);
+    get_end(c);
+    if (c->user[0]) met_add(M_SESSIONS, -1);
+    if (c->dslot) sd_release(&sessions, c->dslot);
+    if (c->shard) atomic_fetch_sub_explicit(&c->shard->active, 1, memory_order_relaxed);
+    if (c->up.fd >= 0) { file_unreserve(c); close(c->up.fd); }
+    if (c->pipefd[0] >= 0) { close(c->pipefd[0]); close(c->pipefd[1]); }
+    free(c->up.zbuf);
+    free(c->up.fbuf);
+    free(c->up.wbuf);
+    if (c->in.data) pool_put(&buf_pool, &buf_tc, c->in.data);
+    if (c->ur.bid >= 0) uring_buf_put(&c->shard->ur->bufs, (unsigned)c->ur.bid);
+    if (c->ur.msg) pool_put(&buf_pool, &buf_tc, c->ur.msg);
+    close(c->sock);
+    pool_put(&ctx_pool, &ctx_tc, c);
+}
+static void uring_abort(client_ctx *c);
+static void room_leave(client_ctx *c);
+static void room_purge(client_ctx *c);
+static bool online_del(client_ctx *c);
+static void relay_purge(client_ctx *c);
+static void ctx_free(client_ctx *c) {
+    if (c->shard) {
+        tw_cancel(&c->shard->tw, &c->tmr);
+        if (c->w_prev) c->w_prev->w_next = c->w_next; else c->shard->conns = c->w_next;
+        if (c->w_next) c->w_next->w_prev = c->w_prev;
+    }
+    if (online_del(c)) relay_purge(c);
+    room_leave(c);
+    room_purge(c);
+    // -m uring: el kernel aún usa sus buffers; se termina al volver la última operación
+    if (c->ur.in || c->ur.out) { uring_abort(c); return; }
+    ctx_release(c);
+}
 
-        // FILE <nombre> <bytes>
-        if (strncasecmp(line, "FILE ", 5) == 0) {
-            char fname[256]; long long fsz = -1;
-            if (sscanf(line + 5, "%255s %lld", fname, &fsz) != 2 || fsz < 0) {
-                send(sock, "FILE_ERR header\n", 16, 0);
-                continue;
+// Marca de agua alta: deja de leerse la conexión (session_read) para que no produzca más
+// respuestas; se reanuda al bajar de la baja (ctx_advance).
+static void ctx_out_check(client_ctx *c) {
+    if (c->paused || !c->nonblock || c->oq_bytes <= out_high) return;
+    c->paused = true;
+    c->over_since = mono_ns();
+    met_add(M_OUT_PAUSES, 1);
+}
+static void ctx_link(client_ctx *c, oseg *s) {
+    s->next = NULL; s->to = NULL;
+    if (c->oq_tail) c->oq_tail->next = s; else c->oq_head = s;
+    c->oq_tail = s; c->oq_n++;
+    c->oq_bytes += s->b->len - s->off;
+    ctx_out_check(c);
+}
+static bool ctx_input_blocked(const client_ctx *c) { return c->get_fd >= 0 || c->paused || c->rl.wait; }
+// Lento: se le desconecta sin esperar a que vacíe la cola.
+static void ctx_evict(client_ctx *c, const char *why) {
+    if (c->evicted) return;
+    c->evicted = true;
+    c->state = ST_CLOSE;
+    met_add(M_SLOW_EVICT, 1);
+    alog("[LENTO] %s @ %s desconectado (%s, %zu bytes en cola)\n", ctx_user(c), c->ipport, why, c->oq_bytes);
+}
+// Quita de la cola los w bytes que acaba de aceptar el socket.
+static void ctx_advance(client_ctx *c, size_t w) {
+    while (c->oq_head) {
+        oseg *s = c->oq_head;
+        size_t left = s->b->len - s->off;
+        if (w < left) { s->off += w; c->oq_bytes -= w; break; }
+        w -= left;
+        c->oq_bytes -= left;
+        c->oq_head = s->next;
+        if (!c->oq_head) c->oq_tail = NULL;
+        c->oq_n--;
+        if (c->get_fd >= 0) c->get_before--;
+        obuf_put(s->b); free(s);
+    }
+    if (c->paused && c->oq_bytes <= out_low) { c->paused = false; c->over_since = 0; }
+}
+// Envía la cola con writev() (hasta IOV_BATCH segmentos por llamada) y, en su sitio, el
+// contenido del GET en curso. Devuelve 0 (vacío o EAGAIN) o -1 si el socket falló.
+// En -m uring solo se pone en marcha el envío (uring_send) y se completa en el bucle.
+static int uring_send(client_ctx *c);
+static int ctx_flush(client_ctx *c) {
+    if (c->shard && c->shard->ur) return uring_send(c);
+    while (1) {
+        int lim = c->get_fd >= 0 ? c->get_before : IOV_BATCH;
+        if (c->oq_head && lim > 0) {
+            struct iovec iov[IOV_BATCH]; int n = 0;
+            for (oseg *s = c->oq_head; s && n < lim && n < IOV_BATCH; s = s->next, n++) {
+                iov[n].iov_base = s->b->data + s->off;
+                iov[n].iov_len = s->b->len - s->off;
             }
-            if (receive_file(sock, fname, fsz, ctx->user[0] ? ctx->user : "?", ipport) == 0) {
-                char okmsg[512];
-                snprintf(okmsg, sizeof(okmsg), "FILE_OK %s %lld\n", fname, fsz);
-                send(sock, okmsg, strlen(okmsg), 0);
-            } else {
-                send(sock, "FILE_ERR io\n", 12, 0);
+            ssize_t w = writev(c->sock, iov, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // En fork el socket es bloqueante con SO_SNDTIMEO: el cliente no lee
+                    if (!c->nonblock) { ctx_evict(c, "envío bloqueado"); return -1; }
+                    return 0;
+                }
+                return -1;
             }
+            ctx_bytes_out(c, w);
+            c->last_out = ctx_tick(c);
+            ctx_advance(c, (size_t)w);
             continue;
         }
+        if (c->get_fd < 0) return 0;
+        while (c->get_left > 0) {
+            size_t want = c->get_left > (1 << 30) ? (1 << 30) : (size_t)c->get_left;
+            ssize_t w = c->rl.dst ? splice(c->get_fd, NULL, c->sock, NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+                                  : sendfile(c->sock, c->get_fd, &c->get_off, want);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (!c->nonblock) { ctx_evict(c, "envío bloqueado"); return -1; }
+                    return 0;
+                }
+                return -1;
+            }
+            if (w == 0) return -1;     // el archivo encogió (o el emisor del SENDTO se fue)
+            ctx_bytes_out(c, w);
+            met_add(c->rl.dst ? M_RELAY_BYTES : M_GET_BYTES, w);
+            if (c->rl.dst) relay_dst_tick(c);
+            c->get_left -= w;
+            c->last_out = ctx_tick(c);
+        }
+        if (!c->rl.dst) met_add(M_GETS, 1);
+        get_end(c);                    // y sigue con lo que llegó a la cola detrás
+    }
+}
+static bool ctx_out_empty(const client_ctx *c) { return !c->oq_head && c->get_fd < 0; }
 
-        // Mensaje normal: imprimir en servidor y responder
-        char when[32]; now_str(when, sizeof(when));
-        printf("[%s] %s @ %s: %s\n", when, ctx->user[0] ? ctx->user : "?", ipport, line);
-        fflush(stdout);
+// Añade a la cola sin enviar: detrás del último buffer privado si cabe (y no es anterior
+// al contenido de un GET en curso), si no en uno nuevo.
+static void ctx_queue(client_ctx *c, const void *data, size_t len) {
+    oseg *t = c->oq_tail;
+    if (!t || !t->b->priv || t->b->cap - t->b->len < len || (c->get_fd >= 0 && c->oq_n <= c->get_before)) {
+        obuf *b = obuf_new(len > BUFFER_SIZE ? len : BUFFER_SIZE, true);
+        if (!b || !(t = (oseg*)malloc(sizeof(oseg)))) {
+            if (b) obuf_put(b);
+            c->state = ST_CLOSE;
+            return;
+        }
+        t->b = b; t->off = 0;
+        ctx_link(c, t);
+    }
+    memcpy(t->b->data + t->b->len, data, len);
+    t->b->len += len;
+    c->oq_bytes += len;
+    ctx_out_check(c);
+}
+static void ctx_push(client_ctx *c) {
+    if (!c->corked && ctx_flush(c) != 0) c->state = ST_CLOSE;
+}
+// Respuesta al cliente (en modo binario, dentro de una trama FR_REPLY). Se envía al momento
+// salvo durante session_consume(), que junta las de todo el lote en un solo send().
+// En modo fork el send() bloquea; en epoll lo que no quepa espera a EPOLLOUT.
+static void ctx_send(client_ctx *c, const char *data, size_t len) {
+    if (c->binary) {
+        unsigned char h[FRAME_HDR]; frame_put_hdr(h, FR_REPLY, (uint32_t)len);
+        ctx_queue(c, h, sizeof(h));
+    }
+    ctx_queue(c, data, len);
+    ctx_push(c);
+}
+static void ctx_send_str(client_ctx *c, const char *s) { ctx_send(c, s, strlen(s)); }
 
-        // Respuesta (puedes personalizarla; por simplicidad, eco con prefijo)
-        char reply[BUFFER_SIZE + 64];
-        snprintf(reply, sizeof(reply), "SERVIDOR: %s\n", line);
-        send(sock, reply, strlen(reply), 0);
+// --- Salas (solo modo epoll: en fork cada conexión vive en su propio proceso) ---
+// Registro global con su cerrojo (entrar y salir es raro); cada sala con el suyo para
+// la lista de miembros. Orden de cerrojos: rooms_mu -> room->mu -> buzón de un worker.
+typedef struct { client_ctx *c; worker *w; bool binary; } room_member;
+
+typedef struct room {
+    char name[64];
+    pthread_mutex_t mu;
+    room_member *members;
+    int n, cap;
+    struct room *next;
+} room;
+
+static pthread_mutex_t rooms_mu = PTHREAD_MUTEX_INITIALIZER;
+static room *rooms = NULL;
+
+static void room_leave(client_ctx *c) {
+    room *r = c->rm.room;
+    if (!r) return;
+    pthread_mutex_lock(&rooms_mu);
+    pthread_mutex_lock(&r->mu);
+    room_member last = r->members[--r->n];
+    r->members[c->rm.idx] = last;
+    last.c->rm.idx = c->rm.idx;
+    bool empty = r->n == 0;
+    pthread_mutex_unlock(&r->mu);
+    if (empty) {
+        for (room **pp = &rooms; *pp; pp = &(*pp)->next)
+            if (*pp == r) { *pp = r->next; break; }
+        pthread_mutex_destroy(&r->mu);
+        free(r->members); free(r);
     }
+    pthread_mutex_unlock(&rooms_mu);
+    c->rm.room = NULL;
+}
+// Devuelve los miembros tras entrar, -1 sin memoria.
+static int room_join(client_ctx *c, const char *name) {
+    room_leave(c);
+    pthread_mutex_lock(&rooms_mu);
+    room *r = rooms;
+    while (r && strcmp(r->name, name) != 0) r = r->next;
+    if (!r) {
+        if (!(r = (room*)calloc(1, sizeof(room)))) { pthread_mutex_unlock(&rooms_mu); return -1; }
+        snprintf(r->name, sizeof(r->name), "%s", name);
+        pthread_mutex_init(&r->mu, NULL);
+        r->next = rooms; rooms = r;
+    }
+    pthread_mutex_lock(&r->mu);
+    int n = -1;
+    if (r->n == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 8;
+        room_member *m = (room_member*)realloc(r->members, (size_t)cap * sizeof(room_member));
+        if (m) { r->members = m; r->cap = cap; }
+    }
+    if (r->n < r->cap) {
+        r->members[r->n] = (room_member){ c, c->shard, c->binary };
+        c->rm.idx = r->n++;
+        c->rm.room = r; c->rm.roomed = true;
+        n = r->n;
+    }
+    pthread_mutex_unlock(&r->mu);
+    pthread_mutex_unlock(&rooms_mu);
+    return n;
+}
+static void room_set_binary(client_ctx *c) {
+    if (!c->rm.room) return;
+    pthread_mutex_lock(&c->rm.room->mu);
+    c->rm.room->members[c->rm.idx].binary = c->binary;
+    pthread_mutex_unlock(&c->rm.room->mu);
+}
+// "ROOMS sala=miembros ...\n"
+static size_t room_list(char *out, size_t cap) {
+    size_t n = (size_t)snprintf(out, cap, "ROOMS");
+    pthread_mutex_lock(&rooms_mu);
+    for (room *r = rooms; r && n < cap; r = r->next)
+        n += (size_t)snprintf(out + n, cap - n, " %s=%d", r->name, r->n);
+    pthread_mutex_unlock(&rooms_mu);
+    if (n >= cap - 1) n = cap - 2;
+    out[n++] = '\n'; out[n] = '\0';
+    return n;
+}
 
-done:
-    close(sock);
-    free(ctx);
-    return NULL;
+// Difunde "[sala] usuario: msg" a todos los miembros (el emisor incluido, así ve el orden de
+// la sala). Se codifica como mucho dos veces, texto y trama FR_MSG, y cada miembro recibe un
+// segmento que apunta al mismo buffer. Los segmentos se agrupan por worker: un cerrojo y
+// un eventfd por worker y mensaje, no por destinatario. Se entregan con la sala bloqueada
+// para que ningún miembro pueda liberarse con un segmento suyo aún en camino al buzón.
+static void room_broadcast(client_ctx *c, const char *msg, size_t len) {
+    room *r = c->rm.room;
+    worker *self = c->shard;
+    char prefix[384];
+    int pl = snprintf(prefix, sizeof(prefix), "[%s] %s: ", r->name, c->user);
+    size_t text_len = (size_t)pl + len;
+    obuf *enc[2] = { NULL, NULL };             // [0] texto, [1] binario
+    long delivered = 0;
+    pthread_mutex_lock(&r->mu);
+    for (int i = 0; i < r->n; i++) {
+        room_member *m = &r->members[i];
+        int k = m->binary ? 1 : 0;
+        if (!enc[k]) {
+            if (!(enc[k] = obuf_new(text_len + FRAME_HDR + 1, false))) continue;
+            char *p = enc[k]->data;
+            if (k) { frame_put_hdr((unsigned char*)p, FR_MSG, (uint32_t)text_len); p += FRAME_HDR; }
+            memcpy(p, prefix, (size_t)pl); memcpy(p + pl, msg, len);
+            enc[k]->len = text_len + (k ? FRAME_HDR : 1);
+            if (!k) p[text_len] = '\n';
+        }
+        oseg *s = (oseg*)malloc(sizeof(oseg));
+        if (!s) continue;
+        atomic_fetch_add_explicit(&enc[k]->refs, 1, memory_order_relaxed);
+        s->b = enc[k]; s->off = 0; s->to = m->c; s->next = NULL;
+        int id = m->w->id;
+        if (self->stage_tail[id]) self->stage_tail[id]->next = s; else self->stage_head[id] = s;
+        self->stage_tail[id] = s;
+        delivered++;
+    }
+    for (int id = 0; id < nworkers; id++) {
+        oseg *h = self->stage_head[id];
+        if (!h) continue;
+        worker *w = self - self->id + id;
+        pthread_mutex_lock(&w->mb_mu);
+        if (w->mb_tail) w->mb_tail->next = h; else w->mb_head = h;
+        w->mb_tail = self->stage_tail[id];
+        pthread_mutex_unlock(&w->mb_mu);
+        uint64_t one = 1;
+        if (write(w->mb_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("eventfd");
+        self->stage_head[id] = self->stage_tail[id] = NULL;
+    }
+    pthread_mutex_unlock(&r->mu);
+    if (enc[0]) obuf_put(enc[0]);
+    if (enc[1]) obuf_put(enc[1]);
+    met_add(M_ROOM_MSGS, 1);
+    met_add(M_ROOM_DELIVERIES, delivered);
 }
 
-int main(void) {
-    signal(SIGCHLD, SIG_IGN);
-    signal(SIGPIPE, SIG_IGN);
+// Al liberar la conexión: fuera de la sala ya nadie le deja nada, se quita lo que aún
+// esté en el buzón de su worker.
+static void room_purge(client_ctx *c) {
+    if (!c->rm.roomed) return;
+    worker *w = c->shard;
+    pthread_mutex_lock(&w->mb_mu);
+    oseg **pp = &w->mb_head, *prev = NULL;
+    while (*pp) {
+        oseg *s = *pp;
+        if (s->to == c) { *pp = s->next; obuf_put(s->b); free(s); }
+        else { prev = s; pp = &s->next; }
+    }
+    w->mb_tail = prev;
+    pthread_mutex_unlock(&w->mb_mu);
+}
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) { perror("socket"); exit(EXIT_FAILURE); }
+// JOIN <sala> (sale de la anterior), LEAVE o ROOMS.
+static void cmd_room(client_ctx *c, const char *line) {
+    char name[64], msg[BUFFER_SIZE];
+    if (!c->shard) { ctx_send_str(c, "ROOM_ERR modo: las salas requieren -m epoll o uring\n"); return; }
+    if (line[0] == 'R' || line[0] == 'r') { ctx_send(c, msg, room_list(msg, sizeof(msg))); return; }
+    if (line[0] == 'L' || line[0] == 'l') {
+        if (!c->rm.room) { ctx_send_str(c, "LEAVE_ERR sin sala\n"); return; }
+        snprintf(msg, sizeof(msg), "LEAVE_OK %s\n", c->rm.room->name);
+        room_leave(c);
+        ctx_send_str(c, msg);
+        return;
+    }
+    if (sscanf(line + 5, "%63s", name) != 1) { ctx_send_str(c, "JOIN_ERR header\n"); return; }
+    int n = room_join(c, name);
+    if (n < 0) { ctx_send_str(c, "JOIN_ERR memoria\n"); return; }
+    alog("[SALA] %s @ %s entra en %s (%d miembros)\n", c->user, c->ipport, name, n);
+    snprintf(msg, sizeof(msg), "JOIN_OK %s %d\n", name, n);
+    ctx_send_str(c, msg);
+}
+// --- Almacén direccionado por contenido (--dedup) ---
+// uploads/.store/<sha256> guarda cada contenido una vez y uploads/<nombre> es un enlace duro
+// a su blob. Un blob nunca se reescribe: start_file() desenlaza el nombre antes de crearlo.
+static bool valid_sha_hex(const char *s) {
+    if (strlen(s) != 64) return false;
+    for (int i = 0; i < 64; i++) if (!isdigit((unsigned char)s[i]) && (s[i] < 'a' || s[i] > 'f')) return false;
+    return true;
+}
+// path pasa a ser un enlace a blob (enlace temporal + rename: nadie ve el nombre a medias).
+static int link_blob(const char *blob, const char *path) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)gettid());
+    unlink(tmp);
+    if (link(blob, tmp) != 0) return -1;
+    int r = rename(tmp, path);
+    unlink(tmp);                   // si path ya era ese mismo inodo, rename() no hace nada
+    return r;
+}
+// FILE recibido con --dedup: el fichero se convierte en blob o, si ese contenido ya estaba,
+// se sustituye por un enlace al existente (y su espacio se libera).
+static const char *store_file(client_ctx *c) {
+    unsigned char d[32]; char hex[65], blob[512];
+    sha256_final(&c->up.sha, d); sha256_hex(d, hex);
+    snprintf(blob, sizeof(blob), "%s/%s", STORE_DIR, hex);
+    if (mkdir(STORE_DIR, 0755) != 0 && errno != EEXIST) return "sin almacén";
+    if (link(c->up.path, blob) == 0) return "blob nuevo";
+    if (errno == EEXIST && link_blob(blob, c->up.path) == 0) return "blob ya existente";
+    return "sin almacén";
+}
+static void cmd_have(client_ctx *c, const char *hex, long long size, const char *rawname) {
+    char safe[256], path[512], blob[512]; struct stat st;
+    sanitize_filename(rawname, safe, sizeof(safe));
+    snprintf(path, sizeof(path), "%s/%s", UPLOAD_DIR, safe);
+    snprintf(blob, sizeof(blob), "%s/%s", STORE_DIR, hex);
+    if (!dedup || stat(blob, &st) != 0 || (long long)st.st_size != size || link_blob(blob, path) != 0) {
+        char msg[96]; snprintf(msg, sizeof(msg), "HAVE_NO %s\n", hex);
+        ctx_send_str(c, msg);
+        return;
+    }
+    met_add(M_FILES, 1);
+    met_add(M_DEDUP_HITS, 1);
+    met_add(M_DEDUP_BYTES, size);
+    alog("[ARCHIVO] %s@%s -> %s (%lld bytes, ya en el almacén: nada que recibir)\n", ctx_user(c), c->ipport, path, size);
+    char okmsg[512];
+    snprintf(okmsg, sizeof(okmsg), "FILE_OK %s %lld dedup\n", rawname, size);
+    ctx_send_str(c, okmsg);
+}
 
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// --- Escritura de subidas: --store-mode, --no-prealloc, --fsync ---
+// plain: cada trozo recibido se escribe tal cual (o con splice()). coalesce: se junta en un
+// buffer alineado de store_buf bytes y se escribe en bloques grandes; direct: igual, con
+// O_DIRECT (sin pasar por la caché de páginas; el último trozo, no alineado, ya sin él).
+// Un FILE se reserva con fallocate(FALLOC_FL_KEEP_SIZE) por tramos de PREALLOC_STEP por delante
+// de lo recibido (menos fragmentación), nunca el tamaño declarado de golpe: si la subida se
+// corta, file_unreserve() devuelve lo reservado de más y el fichero no aparenta un tamaño que
+// no tiene. Los CHUNK no reservan: escriben en huecos de un fichero con datos ya apuntados.
+#define DIRECT_ALIGN 4096
+#define PREALLOC_STEP (16LL << 20)
+static bool direct_warned = false;
 
-    struct sockaddr_in address; socklen_t addrlen = sizeof(address);
-    memset(&address, 0, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+// Reserva hasta PREALLOC_STEP más allá de pos (sin pasar de pa_lim) si queda menos de medio tramo.
+static void file_reserve(client_ctx *c, long long pos) {
+    if (c->up.fd < 0 || c->up.pa_end >= c->up.pa_lim || c->up.pa_end - pos >= PREALLOC_STEP / 2) return;
+    long long end = pos + PREALLOC_STEP < c->up.pa_lim ? pos + PREALLOC_STEP : c->up.pa_lim;
+    if (fallocate(c->up.fd, FALLOC_FL_KEEP_SIZE, c->up.pa_end, end - c->up.pa_end) == 0) c->up.pa_end = end;
+    else c->up.pa_lim = 0;            // si no se admite, sin reserva
+}
+// Subida cortada: lo reservado más allá de lo escrito vuelve al sistema de ficheros. El tamaño
+// es lo escrito (KEEP_SIZE); truncar a ese mismo tamaño libera los bloques de detrás (ext4 no
+// admite PUNCH_HOLE pasado el final).
+static void file_unreserve(client_ctx *c) {
+    struct stat st;
+    if (c->up.fd >= 0 && c->up.pa_end > 0 && fstat(c->up.fd, &st) == 0 && st.st_size < c->up.pa_end &&
+        ftruncate(c->up.fd, st.st_size) != 0) perror("ftruncate");
+    c->up.pa_end = c->up.pa_lim = 0;
+}
+static void file_fail(client_ctx *c) {
+    if (c->up.fd >= 0) { file_unreserve(c); close(c->up.fd); c->up.fd = -1; }
+}
+static void file_sync(client_ctx *c) {
+    if (c->up.fd < 0 || c->up.unsynced == 0) return;
+    uint64_t t0 = mono_ns();
+    if (fdatasync(c->up.fd) != 0) file_fail(c);
+    met_hist(H_SYNC_NS, mono_ns() - t0);
+    c->up.unsynced = 0;
+}
+// n bytes acaban de llegar al fichero: con --fsync N, fdatasync() cada N.
+static void file_wrote(client_ctx *c, size_t n) {
+    file_reserve(c, c->up.off + (long long)n);
+    c->up.unsynced += (long long)n;
+    if (fsync_every > 0 && c->up.unsynced >= fsync_every) file_sync(c);
+}
+static void file_pwrite(client_ctx *c, const void *p, size_t n, long long off) {
+    if (c->up.fd < 0) return;
+    uint64_t t0 = mono_ns();
+    ssize_t w = pwrite(c->up.fd, p, n, off);
+    met_hist(H_WRITE_NS, mono_ns() - t0);
+    if (w != (ssize_t)n) { file_fail(c); return; }
+    file_wrote(c, n);
+}
+// Fichero recién abierto para escribir len bytes desde off.
+static void file_prepare(client_ctx *c, long long off, long long len) {
+    c->up.wb_len = 0; c->up.wb_off = off; c->up.wb_direct = false; c->up.unsynced = 0;
+    c->up.pa_end = c->up.pa_lim = 0;
+    if (c->up.fd < 0 || len <= 0) return;
+    if (prealloc && !c->up.id[0]) { c->up.pa_end = off; c->up.pa_lim = off + len; file_reserve(c, off); }
+    if (store_mode == STORE_PLAIN) return;
+    if (!c->up.wbuf && posix_memalign((void**)&c->up.wbuf, DIRECT_ALIGN, store_buf) != 0) { c->up.wbuf = NULL; return; }
+    if (store_mode == STORE_DIRECT && off % DIRECT_ALIGN == 0) {
+        int fl = fcntl(c->up.fd, F_GETFL);
+        c->up.wb_direct = fl >= 0 && fcntl(c->up.fd, F_SETFL, fl | O_DIRECT) == 0;
+        if (!c->up.wb_direct && !direct_warned) {
+            direct_warned = true;
+            alog("[ARCHIVO] %s no admite O_DIRECT: escrituras agrupadas sin él\n", UPLOAD_DIR);
+        }
+    }
+}
+// Vacía wbuf (si no es un múltiplo del bloque, es el final: sin O_DIRECT).
+static void file_flush(client_ctx *c) {
+    if (!c->up.wb_len) return;
+    if (c->up.wb_direct && c->up.wb_len % DIRECT_ALIGN != 0 && c->up.fd >= 0) {
+        fcntl(c->up.fd, F_SETFL, fcntl(c->up.fd, F_GETFL) & ~O_DIRECT);
+        c->up.wb_direct = false;
+    }
+    file_pwrite(c, c->up.wbuf, c->up.wb_len, c->up.wb_off);
+    c->up.wb_off += (long long)c->up.wb_len;
+    c->up.wb_len = 0;
+}
+// data va en el fichero en c->up.off.
+static void file_write(client_ctx *c, const char *data, size_t len) {
+    if (!c->up.wbuf) { file_pwrite(c, data, len, c->up.off); return; }
+    while (len > 0) {
+        size_t take = store_buf - c->up.wb_len < len ? store_buf - c->up.wb_len : len;
+        memcpy(c->up.wbuf + c->up.wb_len, data, take);
+        c->up.wb_len += take; data += take; len -= take;
+        if (c->up.wb_len == store_buf) file_flush(c);
+    }
+}
+// Fin del contenido (o desconexión): lo pendiente al fichero y fdatasync() según --fsync.
+// Devuelve lo que tardó, para el log.
+static uint64_t file_commit(client_ctx *c) {
+    uint64_t t0 = mono_ns();
+    file_flush(c);
+    free(c->up.wbuf); c->up.wbuf = NULL;
+    if (fsync_every != 0) file_sync(c);
+    uint64_t dt = mono_ns() - t0;
+    met_hist(H_COMMIT_NS, dt);
+    return dt;
+}
+// --fsync: la entrada nueva en uploads/ también tiene que llegar al disco.
+static void sync_upload_dir(void) {
+    int dfd = open(UPLOAD_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) { fsync(dfd); close(dfd); }
+}
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        perror("bind"); close(server_fd); exit(EXIT_FAILURE);
+// --- Recepción de archivos (FILE <nombre> <bytes>) ---
+static void start_file(client_ctx *c, const char *name, long long size) {
+    char safe[256]; sanitize_filename(name, safe, sizeof(safe));
+    snprintf(c->up.path, sizeof(c->up.path), "%s/%s", UPLOAD_DIR, safe);
+    snprintf(c->up.name, sizeof(c->up.name), "%s", name);
+    c->up.size = c->up.left = size;
+    c->up.off = 0;
+    c->up.id[0] = '\0';
+    c->up.spliced = 0;
+    c->up.crc = 0;
+    c->up.crc_want = false;
+    c->up.sha_on = dedup;
+    if (dedup) sha256_init(&c->up.sha);
+    clock_gettime(CLOCK_MONOTONIC, &c->up.t0);
+    // Fichero nuevo en vez de O_TRUNC sobre el viejo: el nombre puede ser un enlace a un blob del almacén
+    c->up.fd = -1;
+    if (ensure_upload_dir() == 0) {
+        unlink(c->up.path);
+        c->up.fd = open(c->up.path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
     }
-    if (listen(server_fd, 16) < 0) {
-        perror("listen"); close(server_fd); exit(EXIT_FAILURE);
+    file_prepare(c, 0, size);
+    c->state = ST_FILE;
+}
+static void finish_chunk(client_ctx *c);
+static void finish_file(client_ctx *c) {
+    free(c->up.fbuf); c->up.fbuf = NULL;
+    if (c->up.id[0]) { finish_chunk(c); return; }
+    c->state = ST_CHAT;
+    bool z = c->up.zbuf != NULL;
+    free(c->up.zbuf); c->up.zbuf = NULL;
+    uint64_t commit_ns = file_commit(c);
+    if (c->up.fd < 0) { met_add(M_FILE_ERR, 1); ctx_send_str(c, "FILE_ERR io\n"); return; }
+    close(c->up.fd); c->up.fd = -1;
+    if (fsync_every != 0) sync_upload_dir();
+    char fs[32], how[128];
+    if (fsync_every > 0) snprintf(fs, sizeof(fs), "cada %lld MB", fsync_every >> 20);
+    else snprintf(fs, sizeof(fs), "%s", fsync_every < 0 ? "al final" : "no");
+    snprintf(how, sizeof(how), "%s%s, fsync %s, cierre %.1f ms", store_names[store_mode],
+             prealloc ? "+fallocate" : "", fs, (double)commit_ns / 1e6);
+    if (c->up.crc_want && c->up.crc != c->up.crc_expect) {
+        unlink(c->up.path);
+        met_add(M_FILE_ERR, 1);
+        alog("[ARCHIVO] %s@%s: CRC32C de %s no coincide (cliente %08x, recibido %08x); descartado\n",
+             ctx_user(c), c->ipport, c->up.path, c->up.crc_expect, c->up.crc);
+        char msg[400];
+        snprintf(msg, sizeof(msg), "FILE_ERR crc %s %08x %08x\n", c->up.name, c->up.crc_expect, c->up.crc);
+        ctx_send_str(c, msg);
+        return;
+    }
+    const char *store = c->up.sha_on ? store_file(c) : NULL;
+    struct timespec t1; clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - c->up.t0.tv_sec) + (double)(t1.tv_nsec - c->up.t0.tv_nsec) / 1e9;
+    double mbs = secs > 0 ? (double)c->up.size / secs / 1e6 : 0.0;
+    if (store)
+        alog("[ARCHIVO] %s@%s -> %s (%lld bytes, %.1f MB/s, %s; %s)\n", ctx_user(c), c->ipport, c->up.path,
+             c->up.size, mbs, store, how);
+    else if (z)
+        alog("[ARCHIVO] %s@%s -> %s (%lld bytes, %lld comprimidos, ratio %.2f, %.1f MB/s efectivos, lz; %s)\n",
+             ctx_user(c), c->ipport, c->up.path, c->up.size, c->up.zwire,
+             c->up.zwire > 0 ? (double)c->up.size / (double)c->up.zwire : 1.0, mbs, how);
+    else
+        alog("[ARCHIVO] %s@%s -> %s (%lld bytes, %.1f MB/s, %s; %s)\n", ctx_user(c), c->ipport, c->up.path,
+             c->up.size, mbs, c->up.spliced > 0 ? (c->shard && c->shard->ur ? "io_uring" : "splice") : "copia", how);
+    met_add(M_FILES, 1);
+    met_add(M_UPLOAD_BYTES, c->up.size);
+    met_hist(H_UPLOAD_US, (uint64_t)(secs * 1e6));
+    met_hist(H_UPLOAD_BYTES, (uint64_t)c->up.size);
+    // El CRC solo vuelve si el cliente mandó el suyo (con él no hay splice: se calcula aquí)
+    char okmsg[512];
+    if (c->up.crc_want) snprintf(okmsg, sizeof(okmsg), "FILE_OK %s %lld %08x\n", c->up.name, c->up.size, c->up.crc);
+    else snprintf(okmsg, sizeof(okmsg), "FILE_OK %s %lld\n", c->up.name, c->up.size);
+    ctx_send_str(c, okmsg);
+}
+// Escribe un trozo del contenido; si falla la escritura se sigue consumiendo
+// (descartando) el resto para no interpretar el archivo como comandos.
+static void receive_file(client_ctx *c, const char *data, size_t len) {
+    if (c->up.crc_want) c->up.crc = crc32c_update(c->up.crc, data, len);
+    if (c->up.sha_on) sha256_update(&c->up.sha, data, len);
+    file_write(c, data, len);
+    c->up.off += (long long)len;
+    c->up.left -= (long long)len;
+    if (c->up.left == 0) finish_file(c);
+}
+// Copia sin pasar por el rbuf de 4 KB: recv directo a fbuf y receive_file(). Con escrituras
+// agrupadas, directo al hueco libre de wbuf (sin la copia intermedia).
+static ssize_t receive_file_direct(client_ctx *c) {
+    if (c->up.wbuf) {
+        size_t want = store_buf - c->up.wb_len;
+        if ((long long)want > c->up.left) want = (size_t)c->up.left;
+        char *p = c->up.wbuf + c->up.wb_len;
+        ssize_t r;
+        do r = recv(c->sock, p, want, 0);
+        while (r < 0 && errno == EINTR);
+        if (r <= 0) return r;
+        if (c->up.crc_want) c->up.crc = crc32c_update(c->up.crc, p, (size_t)r);
+        if (c->up.sha_on) sha256_update(&c->up.sha, p, (size_t)r);
+        c->up.wb_len += (size_t)r;
+        if (c->up.wb_len == store_buf) file_flush(c);
+        c->up.off += r;
+        c->up.left -= r;
+        if (c->up.left == 0) finish_file(c);
+        return r;
     }
+    if (!c->up.fbuf && !(c->up.fbuf = (char*)malloc(FILE_BUF))) { errno = ENOMEM; return -1; }
+    size_t want = (c->up.left > FILE_BUF) ? FILE_BUF : (size_t)c->up.left;
+    ssize_t r;
+    do r = recv(c->sock, c->up.fbuf, want, 0);
+    while (r < 0 && errno == EINTR);
+    if (r > 0) receive_file(c, c->up.fbuf, (size_t)r);
+    return r;
+}
 
-    printf("Servidor esperando conexiones en el puerto %d...\n", PORT);
-    printf("Usuarios CSV: %s (formato: usuario,contraseña)\n", CSV_PATH);
+// FILEZ: cada bloque de lz.h se acumula en zbuf y, completo, se descomprime y se escribe
+// con pwrite. Un bloque inválido desincroniza el flujo: FILE_ERR y se cierra la conexión.
+static void z_bad(client_ctx *c) {
+    met_add(M_FILE_ERR, 1);
+    alog("[ARCHIVO] %s@%s: bloque comprimido inválido en %s\n", ctx_user(c), c->ipport, c->up.path);
+    ctx_send_str(c, "FILE_ERR formato\n");
+    c->state = ST_CLOSE;
+}
+// Tamaño total del bloque en curso (LZ_HDR si aún falta la cabecera, 0 si es inválida).
+static size_t z_need(const client_ctx *c) {
+    if (c->up.zhave < LZ_HDR) return LZ_HDR;
+    uint32_t wire, raw; lz_get_hdr(c->up.zbuf, &wire, &raw);
+    size_t wlen = wire & ~LZ_STORED;
+    if (wlen > LZ_BOUND(LZ_BLOCK) || raw == 0 || raw > LZ_BLOCK || (long long)raw > c->up.left ||
+        ((wire & LZ_STORED) && wlen != raw)) return 0;
+    return LZ_HDR + wlen;
+}
+// Bloque completo en zbuf: descomprimir y escribir.
+static void z_block(client_ctx *c) {
+    uint32_t wire, raw; lz_get_hdr(c->up.zbuf, &wire, &raw);
+    const unsigned char *blk = c->up.zbuf + LZ_HDR;
+    if (!(wire & LZ_STORED)) {
+        unsigned char *out = c->up.zbuf + LZ_HDR + LZ_BOUND(LZ_BLOCK);
+        if (lz_decompress(blk, c->up.zhave - LZ_HDR, out, LZ_BLOCK) != (long)raw) { z_bad(c); return; }
+        blk = out;
+    }
+    if (c->up.crc_want) c->up.crc = crc32c_update(c->up.crc, blk, raw);
+    if (c->up.sha_on) sha256_update(&c->up.sha, blk, raw);
+    file_write(c, (const char*)blk, raw);
+    c->up.zwire += (long long)c->up.zhave;
+    c->up.zhave = 0;
+    c->up.off += raw;
+    c->up.left -= raw;
+    if (c->up.left == 0) finish_file(c);
+}
+// Desde el buffer de entrada. Devuelve los bytes consumidos de data (no pasa del último bloque).
+static size_t receive_z(client_ctx *c, const char *data, size_t len) {
+    size_t used = 0;
+    while (used < len && c->state == ST_FILE) {
+        size_t need = z_need(c);
+        if (need == 0) { z_bad(c); return len; }
+        size_t take = need - c->up.zhave;
+        if (take > len - used) take = len - used;
+        memcpy(c->up.zbuf + c->up.zhave, data + used, take);
+        c->up.zhave += take; used += take;
+        if (c->up.zhave == need && need > LZ_HDR) z_block(c);
+        else if (c->up.zhave == LZ_HDR && z_need(c) == 0) { z_bad(c); return len; }   // cabecera recién completa
+    }
+    return used;
+}
+// Con el buffer de entrada vacío y la cabecera ya leída, el resto del bloque va directo a zbuf.
+static ssize_t receive_z_direct(client_ctx *c) {
+    size_t need = z_need(c);
+    if (need == 0) { z_bad(c); errno = EPROTO; return -1; }
+    ssize_t r;
+    do r = recv(c->sock, c->up.zbuf + c->up.zhave, need - c->up.zhave, 0);
+    while (r < 0 && errno == EINTR);
+    if (r <= 0) return r;
+    c->up.zhave += (size_t)r;
+    if (c->up.zhave == need) z_block(c);
+    return r;
+}
 
-    while (1) {
-        struct sockaddr_in cliaddr; socklen_t clilen = sizeof(cliaddr);
-        int new_sock = accept(server_fd, (struct sockaddr*)&cliaddr, &clilen);
-        if (new_sock < 0) { if (errno == EINTR) continue; perror("accept"); continue; }
+// Zero-copy: socket -> pipe -> fichero con splice(), sin pasar por el buffer de usuario.
+// Devuelve como recv(): >0 bytes movidos, 0 desconexión, -1 error (EAGAIN en no bloqueante).
+// Si el kernel o el sistema de ficheros no admiten splice se marca splice_off y se usa la copia.
+static ssize_t splice_file_chunk(client_ctx *c) {
+    if (c->pipefd[0] < 0) {
+        if (pipe2(c->pipefd, O_CLOEXEC) != 0) { c->up.splice_off = true; errno = EAGAIN; return -1; }
+        fcntl(c->pipefd[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+    }
+    size_t want = (c->up.left > SPLICE_CHUNK) ? SPLICE_CHUNK : (size_t)c->up.left;
+    ssize_t n;
+    do n = splice(c->sock, NULL, c->pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) { c->up.splice_off = true; errno = EAGAIN; }
+    if (n <= 0) return n;
 
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork"); close(new_sock); continue;
-        } else if (pid == 0) {
-            // Hijo
-            close(server_fd);
+    // Vaciar el pipe al fichero; si falla, descartar lo que quede para no desincronizar el flujo
+    size_t left = (size_t)n;
+    loff_t off = c->up.off;
+    while (left > 0 && c->up.fd >= 0) {
+        ssize_t w = splice(c->pipefd[0], NULL, c->up.fd, &off, left, SPLICE_F_MOVE);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        left -= (size_t)w;
+    }
+    while (left > 0) {
+        char tmp[BUFFER_SIZE];
+        ssize_t r = read(c->pipefd[0], tmp, left > sizeof(tmp) ? sizeof(tmp) : left);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        if (c->up.fd >= 0 && pwrite(c->up.fd, tmp, (size_t)r, off) != r) { close(c->up.fd); c->up.fd = -1; }
+        off += r;
+        left -= (size_t)r;
+    }
+    file_wrote(c, (size_t)n);
+    c->up.spliced += n;
+    c->up.off += n;
+    c->up.left -= n;
+    if (c->up.left == 0) finish_file(c);
+    return n;
+}
 
-            client_ctx *ctx = (client_ctx*)calloc(1, sizeof(client_ctx));
-            ctx->sock = new_sock; ctx->addr = cliaddr; ctx->user[0] = '\0';
+// --- Subidas reanudables / por rangos en paralelo ---
+// UPLOAD <id> <nombre> <total>   registra (o retoma) la subida   -> UPLOAD_HAVE ...
+// UPQUERY <id>                   bytes ya recibidos               -> UPLOAD_HAVE ...
+// CHUNK <id> <offset> <bytes>    + contenido, escrito con pwrite  -> CHUNK_OK <id> <offset> <bytes>
+// UPDONE <id>                    si está completa pasa a uploads/ -> FILE_OK <nombre> <total>
+// UPLOAD_HAVE <id> <total> <recibidos> <off>+<len>,...  (o "-" si no hay rangos)
+// Un CHUNK que se sale de <total> recibe UPLOAD_ERR <id> rango y se cierra la conexión.
+// El estado vive en disco (uploads/.partial/<id>.data y .meta) para que lo compartan las
+// conexiones paralelas (procesos distintos en modo fork) y sobreviva a un reinicio.
+#define PARTIAL_DIR UPLOAD_DIR "/.partial"
+#define MAX_HAVE_RANGES 128
 
-            pthread_t th;
-            if (pthread_create(&th, NULL, client_thread, ctx) != 0) {
-                perror("pthread_create"); close(new_sock); free(ctx); exit(EXIT_FAILURE);
-            }
-            pthread_join(th, NULL);
-            exit(EXIT_SUCCESS);
-        } else {
-            // Padre
-            close(new_sock);
+typedef struct { long long off, len; } byte_range;
+
+static bool valid_upload_id(const char *id) {
+    size_t n = strlen(id);
+    if (n == 0 || n > 64) return false;
+    for (size_t i = 0; i < n; i++)
+        if (!isalnum((unsigned char)id[i]) && id[i] != '_' && id[i] != '-') return false;
+    return true;
+}
+static void partial_path(char *out, size_t n, const char *id, const char *ext) {
+    snprintf(out, n, "%s/%s.%s", PARTIAL_DIR, id, ext);
+}
+static int cmp_range(const void *a, const void *b) {
+    long long x = ((const byte_range*)a)->off, y = ((const byte_range*)b)->off;
+    return (x > y) - (x < y);
+}
+// Lee <id>.meta: cabecera "<total> <nombre>" y un rango "<off> <len>" por línea.
+// Devuelve los rangos ordenados y fusionados; -1 si la subida no existe.
+static int upload_load(const char *id, char *name, size_t namesz, long long *total,
+                       byte_range **out, size_t *nout) {
+    char meta[512]; partial_path(meta, sizeof(meta), id, "meta");
+    FILE *f = fopen(meta, "r");
+    if (!f) return -1;
+    char line[512];
+    if (!fgets(line, sizeof(line), f) || sscanf(line, "%lld %255s", total, name) != 2 || *total < 0) { fclose(f); return -1; }
+    name[namesz - 1] = '\0';
+    byte_range *rs = NULL; size_t n = 0, cap = 0;
+    long long off, len;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lld %lld", &off, &len) != 2 || off < 0 || len <= 0 || off > *total || len > *total - off) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            byte_range *p = (byte_range*)realloc(rs, cap * sizeof(byte_range));
+            if (!p) break;
+            rs = p;
+        }
+        rs[n].off = off; rs[n].len = len; n++;
+    }
+    fclose(f);
+    if (n > 1) qsort(rs, n, sizeof(byte_range), cmp_range);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (m > 0 && rs[i].off <= rs[m-1].off + rs[m-1].len) {
+            long long end = rs[i].off + rs[i].len;
+            if (end > rs[m-1].off + rs[m-1].len) rs[m-1].len = end - rs[m-1].off;
+        } else rs[m++] = rs[i];
+    }
+    *out = rs; *nout = m;
+    return 0;
+}
+static void upload_reply_have(client_ctx *c, const char *id) {
+    char name[256]; long long total; byte_range *rs = NULL; size_t n = 0;
+    if (upload_load(id, name, sizeof(name), &total, &rs, &n) != 0) {
+        char msg[160]; snprintf(msg, sizeof(msg), "UPLOAD_ERR %s desconocido\n", id);
+        ctx_send_str(c, msg);
+        return;
+    }
+    long long have = 0;
+    for (size_t i = 0; i < n; i++) have += rs[i].len;
+    char msg[BUFFER_SIZE];
+    size_t len = (size_t)snprintf(msg, sizeof(msg), "UPLOAD_HAVE %s %lld %lld ", id, total, have);
+    if (n == 0) len += (size_t)snprintf(msg + len, sizeof(msg) - len, "-");
+    // Con demasiados huecos solo se listan los primeros: el cliente reenviará algo de más
+    for (size_t i = 0; i < n && i < MAX_HAVE_RANGES && len < sizeof(msg) - 48; i++)
+        len += (size_t)snprintf(msg + len, sizeof(msg) - len, "%s%lld+%lld", i ? "," : "", rs[i].off, rs[i].len);
+    len += (size_t)snprintf(msg + len, sizeof(msg) - len, "\n");
+    ctx_send(c, msg, len);
+    free(rs);
+}
+static int upload_record(const char *id, long long off, long long len) {
+    char meta[512]; partial_path(meta, sizeof(meta), id, "meta");
+    int fd = open(meta, O_WRONLY | O_APPEND);
+    if (fd < 0) return -1;
+    char line[64]; int n = snprintf(line, sizeof(line), "%lld %lld\n", off, len);
+    int rc = (write(fd, line, (size_t)n) == n) ? 0 : -1;   // O_APPEND: líneas cortas atómicas
+    close(fd);
+    return rc;
+}
+static void cmd_upload(client_ctx *c, const char *id, const char *rawname, long long total) {
+    char safe[256]; sanitize_filename(rawname, safe, sizeof(safe));
+    char meta[512], data[512];
+    partial_path(meta, sizeof(meta), id, "meta");
+    partial_path(data, sizeof(data), id, "data");
+    if (ensure_upload_dir() != 0 || (mkdir(PARTIAL_DIR, 0755) != 0 && errno != EEXIST)) {
+        ctx_send_str(c, "UPLOAD_ERR io\n"); return;
+    }
+    int fd = open(meta, O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd >= 0) {
+        char hdr[320]; int n = snprintf(hdr, sizeof(hdr), "%lld %s\n", total, safe);
+        bool ok = write(fd, hdr, (size_t)n) == n;
+        close(fd);
+        int dfd = ok ? open(data, O_CREAT | O_WRONLY, 0644) : -1;
+        if (dfd < 0) { unlink(meta); ctx_send_str(c, "UPLOAD_ERR io\n"); return; }
+        close(dfd);
+        alog("[SUBIDA] %s@%s inicia %s (%s, %lld bytes)\n", ctx_user(c), c->ipport, id, safe, total);
+    } else if (errno == EEXIST) {
+        char name[256]; long long old_total; byte_range *rs = NULL; size_t n = 0;
+        if (upload_load(id, name, sizeof(name), &old_total, &rs, &n) == 0) free(rs);
+        if (old_total != total || strcmp(name, safe) != 0) {
+            char msg[160]; snprintf(msg, sizeof(msg), "UPLOAD_ERR %s distinto\n", id);
+            ctx_send_str(c, msg); return;
+        }
+    } else { ctx_send_str(c, "UPLOAD_ERR io\n"); return; }
+    upload_reply_have(c, id);
+}
+static void cmd_chunk(client_ctx *c, const char *id, long long off, long long len) {
+    char name[256]; long long total; byte_range *rs = NULL; size_t n = 0;
+    bool known = upload_load(id, name, sizeof(name), &total, &rs, &n) == 0;
+    free(rs);
+    // Rango fuera de la subida: sin pasar a ST_FILE, y como con una cabecera mal formada hay
+    // que cerrar (no se va a consumir el contenido). off + len podría desbordar.
+    if (known && (off > total || len > total - off)) {
+        char msg[160]; snprintf(msg, sizeof(msg), "UPLOAD_ERR %s rango\n", id);
+        ctx_send_str(c, msg);
+        c->state = ST_CLOSE;
+        return;
+    }
+    char data[512]; partial_path(data, sizeof(data), id, "data");
+    // El contenido se consume siempre (descartándolo si hay error) para no desincronizar
+    c->state = ST_FILE;
+    snprintf(c->up.id, sizeof(c->up.id), "%s", id);
+    snprintf(c->up.name, sizeof(c->up.name), "%s", name);
+    snprintf(c->up.path, sizeof(c->up.path), "%s", data);
+    c->up.size = c->up.left = len;
+    c->up.off = c->up.chunk_start = off;
+    c->up.spliced = 0;
+    c->up.crc = 0;
+    c->up.crc_want = false;
+    c->up.sha_on = false;
+    clock_gettime(CLOCK_MONOTONIC, &c->up.t0);
+    c->up.fd = known ? open(data, O_WRONLY) : -1;
+    file_prepare(c, off, len);
+    if (len == 0) finish_chunk(c);
+}
+// Rango terminado (o cortado por desconexión): se apunta lo que llegó a escribirse.
+static void chunk_record(client_ctx *c) {
+    long long written = c->up.off - c->up.chunk_start;
+    if (c->up.fd < 0 || written <= 0) return;
+    upload_record(c->up.id, c->up.chunk_start, written);
+    met_add(M_UPLOAD_BYTES, written);
+}
+static void finish_chunk(client_ctx *c) {
+    file_commit(c);
+    c->state = ST_CHAT;
+    char msg[256];
+    if (c->up.fd < 0) {
+        met_add(M_FILE_ERR, 1);
+        snprintf(msg, sizeof(msg), "CHUNK_ERR %s io\n", c->up.id);
+    } else {
+        chunk_record(c);
+        close(c->up.fd); c->up.fd = -1;
+        snprintf(msg, sizeof(msg), "CHUNK_OK %s %lld %lld\n", c->up.id, c->up.chunk_start, c->up.size);
+    }
+    c->up.id[0] = '\0';
+    ctx_send_str(c, msg);
+}
+static void cmd_updone(client_ctx *c, const char *id) {
+    char name[256]; long long total; byte_range *rs = NULL; size_t n = 0;
+    if (upload_load(id, name, sizeof(name), &total, &rs, &n) != 0) {
+        char msg[160]; snprintf(msg, sizeof(msg), "UPLOAD_ERR %s desconocido\n", id);
+        ctx_send_str(c, msg); return;
+    }
+    bool complete = total == 0 || (n == 1 && rs[0].off == 0 && rs[0].len == total);
+    free(rs);
+    if (!complete) { upload_reply_have(c, id); return; }
+    char meta[512], data[512], path[512];
+    partial_path(meta, sizeof(meta), id, "meta");
+    partial_path(data, sizeof(data), id, "data");
+    snprintf(path, sizeof(path), "%s/%s", UPLOAD_DIR, name);
+    if (truncate(data, total) != 0 || rename(data, path) != 0) {
+        char msg[160]; snprintf(msg, sizeof(msg), "UPLOAD_ERR %s io\n", id);
+        ctx_send_str(c, msg); return;
+    }
+    unlink(meta);
+    met_add(M_FILES, 1);
+    met_hist(H_UPLOAD_BYTES, (uint64_t)total);
+    alog("[ARCHIVO] %s@%s -> %s (%lld bytes, subida reanudable %s)\n", ctx_user(c), c->ipport, path, total, id);
+    char okmsg[512];
+    snprintf(okmsg, sizeof(okmsg), "FILE_OK %s %lld\n", name, total);
+    ctx_send_str(c, okmsg);
+}
+
+// --- Descargas: GET <nombre> [offset len] ---
+// Respuesta "GET_OK <nombre> <offset> <len> <total>" y detrás len bytes del archivo sin
+// enmarcar (también en modo binario), con sendfile() desde ctx_flush(). Mientras dura no se
+// procesa más entrada: lo siguiente que pida el cliente sale después del contenido.
+static void cmd_get(client_ctx *c, const char *rawname, long long off, long long len) {
+    char safe[256], msg[400]; long long total = 0; fd_entry *ent = NULL;
+    sanitize_filename(rawname, safe, sizeof(safe));
+    int fd = fdc_open(safe, &total, &ent);
+    if (fd < 0) {
+        snprintf(msg, sizeof(msg), "GET_ERR noexiste %s\n", safe);
+        ctx_send_str(c, msg);
+        return;
+    }
+    if (off > total) {
+        if (ent) ent->refs--; else close(fd);
+        snprintf(msg, sizeof(msg), "GET_ERR rango %s %lld\n", safe, total);
+        ctx_send_str(c, msg);
+        return;
+    }
+    if (len < 0 || len > total - off) len = total - off;
+    alog("[GET] %s@%s <- %s/%s (%lld bytes desde %lld, %s)\n", ctx_user(c), c->ipport, UPLOAD_DIR, safe,
+         len, off, ent ? "fd en caché" : "fd propio");
+    snprintf(msg, sizeof(msg), "GET_OK %s %lld %lld %lld\n", safe, off, len, total);
+    ctx_send_str(c, msg);
+    // El contenido va justo detrás de GET_OK: después de todo lo que ya hay en la cola
+    c->get_fd = fd; c->get_ent = ent;
+    c->get_off = (off_t)off; c->get_left = len;
+    c->get_before = c->oq_n;
+}
+
+// --- SENDTO <usuario> <nombre> <bytes>: reenvío directo entre usuarios (-m epoll o uring) ---
+// El contenido va del socket del emisor a un pipe y del pipe al socket del destinatario con
+// splice(), sin pasar por disco ni por espacio de usuario. Cada extremo lo mueve el worker
+// de su conexión y el pipe es lo único compartido: su capacidad es el control de flujo
+// (lleno, el emisor deja de leer y TCP frena al cliente; vacío, el receptor espera).
+// - El worker del emisor busca al destinatario (online_mu) y deja la oferta en el buzón del
+//   suyo, que le manda "RELAY <de> <nombre> <bytes>" y el contenido como en un GET cuyo
+//   origen es el pipe.
+// - El receptor fija el resultado antes de cerrar su extremo; el emisor se entera por el
+//   POLLERR del suyo (en su epoll o con POLL_ADD) y responde SENDTO_OK o SENDTO_ERR.
+// - Se libera cuando lo han soltado los dos lados, cada uno al final de una vuelta de su
+//   bucle: en el mismo epoll_wait() puede quedar aún un evento suyo.
+enum { RL_SRC, RL_DST };
+#define RL_TAG(rl, side) ((uint64_t)(uintptr_t)(rl) | (uint64_t)((side) + 1))   // epoll: malloc alinea a 16
+
+typedef struct relay {
+    atomic_int refs;               // emisor + receptor
+    atomic_int result;             // lo fija el receptor antes de cerrar pipefd[0]
+    atomic_ullong tick;            // último avance del receptor: el emisor no se da por parado
+    int pipefd[2];                 // cada extremo lo cierra su lado
+    client_ctx *src, *dst;         // src solo lo toca el worker del emisor; dst, el del receptor
+    long long len;
+    char to[SD_USER], name[256];
+    char hdr[560];                 // "RELAY de nombre bytes\n"
+    struct relay *offer_next;      // en el buzón del worker del receptor
+    struct relay *put_next[2];     // en la lista rl_put del worker de cada lado
+} relay;
+
+// Sesiones de epoll/uring a las que se puede enviar (todas las de un mismo proceso)
+static pthread_mutex_t online_mu = PTHREAD_MUTEX_INITIALIZER;
+static client_ctx *online = NULL;
+
+static void online_add(client_ctx *c) {
+    pthread_mutex_lock(&online_mu);
+    c->rl.on_prev = NULL; c->rl.on_next = online;
+    if (online) online->rl.on_prev = c;
+    online = c;
+    c->rl.online = true;
+    pthread_mutex_unlock(&online_mu);
+}
+// true si aún tenía un reenvío ofrecido o en curso
+static bool online_del(client_ctx *c) {
+    if (!c->rl.online) return false;
+    pthread_mutex_lock(&online_mu);
+    if (c->rl.on_prev) c->rl.on_prev->rl.on_next = c->rl.on_next; else online = c->rl.on_next;
+    if (c->rl.on_next) c->rl.on_next->rl.on_prev = c->rl.on_prev;
+    c->rl.online = false;
+    bool busy = c->rl.busy;
+    pthread_mutex_unlock(&online_mu);
+    return busy;
+}
+
+static void relay_put(worker *w, relay *rl, int side) {
+    rl->put_next[side] = w->rl_put[side];
+    w->rl_put[side] = rl;
+}
+// Al final de cada vuelta del bucle del worker
+static void relay_reap(worker *w) {
+    for (int side = RL_SRC; side <= RL_DST; side++) {
+        while (w->rl_put[side]) {
+            relay *rl = w->rl_put[side];
+            w->rl_put[side] = rl->put_next[side];
+            if (atomic_fetch_sub_explicit(&rl->refs, 1, memory_order_acq_rel) == 1) free(rl);
         }
     }
+}
+
+// Emisor: suelta su extremo. Cerrar pipefd[1] también lo saca de su epoll y al receptor le
+// llega EOF si aún esperaba contenido.
+static void relay_src_end(client_ctx *c) {
+    relay *rl = c->rl.src;
+    close(rl->pipefd[1]);
+    rl->src = NULL;
+    c->rl.src = NULL;
+    c->rl.wait = false;
+    relay_put(c->shard, rl, RL_SRC);
+}
+// Receptor: avanzó el contenido (el plazo del emisor cuenta desde aquí)
+static void relay_dst_tick(client_ctx *c) {
+    atomic_store_explicit(&c->rl.dst->tick, loop_tick, memory_order_relaxed);
+}
+// Receptor: fija el resultado y suelta su extremo (el emisor lo ve como POLLERR).
+static void relay_dst_end(client_ctx *c, relay *rl, int res) {
+    atomic_store_explicit(&rl->result, res, memory_order_release);
+    close(rl->pipefd[0]);
+    rl->dst = NULL;
+    pthread_mutex_lock(&online_mu);
+    c->rl.busy = false;
+    pthread_mutex_unlock(&online_mu);
+    if (res == RL_DONE) met_add(M_RELAYS, 1);
+    relay_put(c->shard, rl, RL_DST);
+}
+// Conexión que se cierra con ofertas aún en el buzón de su worker (ya fuera de la lista
+// online: no le llegan más).
+static void relay_purge(client_ctx *c) {
+    worker *w = c->shard;
+    relay *mine = NULL;
+    pthread_mutex_lock(&w->mb_mu);
+    for (relay **pp = &w->rl_offers; *pp; ) {
+        relay *rl = *pp;
+        if (rl->dst == c) { *pp = rl->offer_next; rl->offer_next = mine; mine = rl; }
+        else pp = &rl->offer_next;
+    }
+    pthread_mutex_unlock(&w->mb_mu);
+    while (mine) {
+        relay *rl = mine;
+        mine = rl->offer_next;
+        relay_dst_end(c, rl, RL_FAILED);
+    }
+}
 
-    close(server_fd);
+// Emisor con todo el contenido en el pipe: responde en cuanto el receptor fija el
+// resultado. false si aún no lo ha hecho.
+static bool relay_src_done(client_ctx *c) {
+    relay *rl = c->rl.src;
+    int res = atomic_load_explicit(&rl->result, memory_order_acquire);
+    if (res == RL_PENDING) return false;
+    char msg[400];
+    if (res == RL_DONE) snprintf(msg, sizeof(msg), "SENDTO_OK %s %s %lld\n", rl->to, rl->name, rl->len);
+    else snprintf(msg, sizeof(msg), "SENDTO_ERR %s %s\n", res == RL_BUSY ? "ocupado" : "cortado", rl->to);
+    alog("[SENDTO] %s @ %s -> %s: %s (%lld bytes) %s\n", c->user, c->ipport, rl->to, rl->name, rl->len,
+         res == RL_DONE ? "entregado" : "no entregado");
+    relay_src_end(c);
+    c->state = ST_CHAT;
+    ctx_send_str(c, msg);
+    return true;
+}
+// El receptor ya no está (EPIPE): se responde ya y el resto del contenido se descarta.
+static void relay_src_fail(client_ctx *c) {
+    relay *rl = c->rl.src;
+    int res = atomic_load_explicit(&rl->result, memory_order_acquire);
+    char msg[128];
+    snprintf(msg, sizeof(msg), "SENDTO_ERR %s %s\n", res == RL_BUSY ? "ocupado" : "cortado", rl->to);
+    alog("[SENDTO] %s @ %s -> %s: %s cortado a falta de %lld bytes\n", c->user, c->ipport, rl->to, rl->name, c->rl.left);
+    relay_src_end(c);
+    ctx_send_str(c, msg);
+}
+static void uring_relay_wait(client_ctx *c);
+// n bytes más del contenido del emisor, reenviados o descartados.
+static void relay_src_moved(client_ctx *c, long long n) {
+    c->rl.left -= n;
+    if (c->rl.left > 0) return;
+    if (!c->rl.src) { c->state = ST_CHAT; return; }
+    c->rl.wait = true;                 // no se lee nada más hasta responder
+    if (!relay_src_done(c) && c->shard->ur) uring_relay_wait(c);
+}
+// Contenido que llegó en el rbuf (con la cabecera): al pipe, recién creado, donde cabe entero.
+static void relay_src_data(client_ctx *c, const char *p, size_t n) {
+    if (c->rl.src && n > 0 && write(c->rl.src->pipefd[1], p, n) != (ssize_t)n) relay_src_fail(c);
+    relay_src_moved(c, (long long)n);
+}
+// epoll: socket -> pipe. Mismo retorno que recv() (EAGAIN también con el pipe lleno); con
+// el receptor ya cerrado (EPIPE) responde y el resto se descarta por el rbuf.
+static ssize_t relay_splice_in(client_ctx *c) {
+    size_t want = c->rl.left > SPLICE_CHUNK ? SPLICE_CHUNK : (size_t)c->rl.left;
+    ssize_t n = splice(c->sock, NULL, c->rl.src->pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n < 0 && errno == EPIPE) relay_src_fail(c);
+    if (n > 0) {
+        ctx_bytes_in(c, n);
+        relay_src_moved(c, n);
+    }
+    return n;
+}
+
+static void relay_refuse(client_ctx *c, const char *why, const char *user) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "SENDTO_ERR %s %s\n", why, user);
+    ctx_send_str(c, msg);
+    relay_src_moved(c, 0);             // sin contenido ya ha terminado
+}
+static void cmd_sendto(client_ctx *c, const char *user, const char *rawname, long long len) {
+    c->state = ST_RELAY;               // el contenido llega igual: se reenvía o se descarta
+    c->rl.left = len;
+    if (!c->shard) { relay_refuse(c, "modo", user); return; }
+    relay *rl = (relay*)calloc(1, sizeof(*rl));
+    if (!rl) { relay_refuse(c, "memoria", user); return; }
+    // uring: pipe bloqueante, los splice esperan en los hilos del kernel; epoll: sin bloquear
+    if (pipe2(rl->pipefd, O_CLOEXEC | (c->shard->ur ? 0 : O_NONBLOCK)) != 0) {
+        free(rl);
+        relay_refuse(c, "memoria", user);
+        return;
+    }
+    fcntl(rl->pipefd[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+    atomic_init(&rl->refs, 2);
+    atomic_init(&rl->result, RL_PENDING);
+    atomic_init(&rl->tick, loop_tick);
+    rl->len = len;
+    rl->src = c;
+    snprintf(rl->to, sizeof(rl->to), "%s", user);
+    sanitize_filename(rawname, rl->name, sizeof(rl->name));
+    snprintf(rl->hdr, sizeof(rl->hdr), "RELAY %s %s %lld\n", c->user, rl->name, len);
+    // La oferta se deja en el buzón sin soltar online_mu: el destinatario no puede pasar
+    // por ctx_free() entre medias sin encontrarla allí.
+    client_ctx *d = NULL;
+    worker *dw = NULL;
+    bool seen = false;
+    pthread_mutex_lock(&online_mu);
+    for (client_ctx *o = online; o && !d; o = o->rl.on_next) {
+        if (o == c || strcmp(o->user, user) != 0) continue;
+        seen = true;
+        if (!o->rl.busy) d = o;
+    }
+    if (d) {
+        d->rl.busy = true;
+        rl->dst = d;
+        dw = d->shard;
+        pthread_mutex_lock(&dw->mb_mu);
+        rl->offer_next = dw->rl_offers;
+        dw->rl_offers = rl;
+        pthread_mutex_unlock(&dw->mb_mu);
+    }
+    pthread_mutex_unlock(&online_mu);
+    if (!d) {
+        close(rl->pipefd[0]); close(rl->pipefd[1]);
+        free(rl);
+        relay_refuse(c, seen ? "ocupado" : "nadie", user);
+        return;
+    }
+    uint64_t one = 1;
+    if (write(dw->mb_fd, &one, sizeof(one)) < 0) perror("eventfd");
+    alog("[SENDTO] %s @ %s -> %s: %s (%lld bytes)\n", c->user, c->ipport, user, rl->name, len);
+    c->rl.src = rl;
+    if (!c->shard->ur) {
+        struct epoll_event ev = { .events = EPOLLOUT | EPOLLET, .data.u64 = RL_TAG(rl, RL_SRC) };
+        if (epoll_ctl(c->shard->ep, EPOLL_CTL_ADD, rl->pipefd[1], &ev) < 0) { perror("epoll_ctl"); relay_src_fail(c); }
+    }
+    relay_src_moved(c, 0);
+}
+// Receptor, al vaciar su buzón: "RELAY ..." a la cola y el pipe como origen del contenido,
+// igual que un GET. Si entretanto empezó otra cosa (GET, FILE, otro SENDTO), se rechaza.
+static void relay_accept(worker *w, relay *rl) {
+    client_ctx *c = rl->dst;
+    if (c->state != ST_CHAT || c->get_fd >= 0) { relay_dst_end(c, rl, RL_BUSY); return; }
+    if (!w->ur) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.u64 = RL_TAG(rl, RL_DST) };
+        if (epoll_ctl(w->ep, EPOLL_CTL_ADD, rl->pipefd[0], &ev) < 0) { perror("epoll_ctl"); relay_dst_end(c, rl, RL_FAILED); return; }
+    }
+    bool corked = c->corked;
+    c->corked = true;
+    ctx_send_str(c, rl->hdr);
+    c->corked = corked;
+    c->rl.dst = rl;
+    c->get_fd = rl->pipefd[0]; c->get_ent = NULL;
+    c->get_off = 0; c->get_left = rl->len;
+    c->get_before = c->oq_n;
+}
+
+// Uso de los pools de este proceso (en fork, el del hijo que atiende la conexión).
+static size_t pool_format(char *out, size_t cap, const char *prefix) {
+    pool *ps[] = { &ctx_pool, &buf_pool };
+    size_t n = 0;
+    for (size_t i = 0; i < sizeof(ps) / sizeof(ps[0]) && n < cap; i++) {
+        size_t res = pool_reserved(ps[i]);
+        n += (size_t)snprintf(out + n, cap - n, "%spool_%s en_uso=%zu reservados=%zu bytes=%zu\n",
+                              prefix, ps[i]->name, pool_in_use(ps[i]), res, res * ps[i]->size);
+    }
+    return n < cap ? n : cap - 1;
+}
+
+// "WHO usuario ip:puerto entrada=... seg=N in=N out=N msgs=N" por sesión y "WHO_END n".
+// Se lee el directorio compartido sin cerrojos: lo que entre o salga mientras tanto puede
+// aparecer o no, pero nunca a medias. Antes se recuperan los huecos de procesos que ya no
+// existen (un hijo de fork muerto por SIGKILL o el OOM killer no llegó a liberar el suyo).
+static void cmd_who(client_ctx *c, const char *user) {
+    sd_reap(&sessions);
+    size_t cap = ((size_t)sd_live(&sessions) + 16) * 192, n = 0;
+    char *out = (char*)malloc(cap);
+    if (!out) { ctx_send_str(c, "WHO_ERR memoria\n"); return; }
+    time_t now = time(NULL);
+    unsigned found = 0;
+    for (unsigned i = 0; i < sessions.n; i++) {
+        sd_entry e;
+        if (!sd_read(&sessions, i, &e) || (user[0] && strcmp(e.user, user) != 0)) continue;
+        if (cap - n < 512) {       // una línea ocupa menos de 300: siempre queda sitio para WHO_END
+            char *bigger = (char*)realloc(out, cap * 2);
+            if (!bigger) break;
+            out = bigger; cap *= 2;
+        }
+        struct tm tm; time_t t = (time_t)e.login; char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", localtime_r(&t, &tm));
+        n += (size_t)snprintf(out + n, cap - n, "WHO %s %s entrada=%s seg=%lld in=%llu out=%llu msgs=%llu\n",
+                              e.user, e.addr, when, (long long)(now - t), e.bytes_in, e.bytes_out, e.msgs);
+        found++;
+    }
+    n += (size_t)snprintf(out + n, cap - n, "WHO_END %u\n", found);
+    ctx_send(c, out, n);
+    free(out);
+}
+
+// Mensaje de chat: imprimir en servidor y responder con eco
+static void session_msg(client_ctx *c, const char *msg, size_t len) {
+    uint64_t t0 = mono_ns();
+    alog("[%s] %s @ %s: %.*s\n", alog_now(), ctx_user(c), c->ipport, (int)len, msg);
+
+    // En una sala, a todos sus miembros; si no, eco con prefijo
+    if (c->rm.room) {
+        room_broadcast(c, msg, len);
+    } else if (c->binary) {
+        // Cabecera, prefijo y carga directos al buffer de salida, sin formatear
+        unsigned char h[FRAME_HDR]; frame_put_hdr(h, FR_MSG, (uint32_t)(len + 10));
+        ctx_queue(c, h, sizeof(h));
+        ctx_queue(c, "SERVIDOR: ", 10);
+        ctx_queue(c, msg, len);
+        ctx_push(c);
+    } else {
+        char reply[BUFFER_SIZE + 64];
+        snprintf(reply, sizeof(reply), "SERVIDOR: %.*s\n", (int)len, msg);
+        ctx_send_str(c, reply);
+    }
+    met_add(M_MSGS, 1);
+    if (c->dslot) atomic_fetch_add_explicit(&c->dslot->msgs, 1, memory_order_relaxed);
+    met_hist(H_MSG_NS, mono_ns() - t0);
+}
+
+// --- Máquina de estados: una línea completa ---
+static void session_line(client_ctx *c, char *line) {
+    if (c->state == ST_AUTH) {
+        uint64_t t0 = mono_ns();
+        char user[256], pass[256];
+        if (strncasecmp(line, "AUTH ", 5) != 0 ||
+            sscanf(line + 5, "%255s %255s", user, pass) != 2 || !check_credentials(user, pass, &c->admin)) {
+            ctx_send(c, "AUTH_FAIL\n", 10);
+            c->state = ST_CLOSE;
+            met_add(M_AUTH_FAIL, 1);
+            met_hist(H_AUTH_NS, mono_ns() - t0);
+            return;
+        }
+        strncpy(c->user, user, sizeof(c->user)-1);
+        c->user[sizeof(c->user)-1] = '\0';
+        c->state = ST_CHAT;
+        ctx_send(c, "AUTH_OK\n", 8);
+        met_add(M_AUTH_OK, 1);
+        met_add(M_SESSIONS, 1);
+        c->dslot = sd_claim(&sessions, c->user, c->ipport, time(NULL));
+        if (c->shard) online_add(c);
+        met_hist(H_AUTH_NS, mono_ns() - t0);
+        alog("[LOGIN] %s conectado desde %s\n", c->user, c->ipport);
+        return;
+    }
+
+    if (line[0] == '\0') return;
+
+    // salir
+    if (strncasecmp(line, "salir", 5) == 0 && (line[5] == '\0' || isspace((unsigned char)line[5]))) {
+        ctx_send(c, "BYE\n", 4);
+        alog("[SALIR] %s @ %s cerró sesión\n", c->user, c->ipport);
+        c->state = ST_CLOSE;
+        return;
+    }
+
+    // FILE <nombre> <bytes> [crc32c]
+    if (strncasecmp(line, "FILE ", 5) == 0) {
+        char fname[256]; long long fsz = -1; uint32_t crc = 0;
+        int n = sscanf(line + 5, "%255s %lld %8x", fname, &fsz, &crc);
+        if (n < 2 || fsz < 0) {
+            ctx_send(c, "FILE_ERR header\n", 16);
+            return;
+        }
+        start_file(c, fname, fsz);
+        c->up.crc_want = n == 3; c->up.crc_expect = crc;
+        if (fsz == 0) finish_file(c);
+        return;
+    }
+
+    // HAVE <sha256> <bytes> <nombre>: si el contenido ya está en el almacén no hace falta enviarlo
+    if (strncasecmp(line, "HAVE ", 5) == 0) {
+        char hex[80], fname[256]; long long fsz = -1;
+        if (sscanf(line + 5, "%79s %lld %255s", hex, &fsz, fname) != 3 || fsz < 0 || !valid_sha_hex(hex)) {
+            ctx_send_str(c, "HAVE_ERR header\n");
+            return;
+        }
+        cmd_have(c, hex, fsz, fname);
+        return;
+    }
+
+    // GET <nombre> [offset [len]]: sin len, hasta el final
+    if (strncasecmp(line, "GET ", 4) == 0) {
+        char fname[256]; long long off = 0, len = -1;
+        int n = sscanf(line + 4, "%255s %lld %lld", fname, &off, &len);
+        if (n < 1 || off < 0 || (n == 3 && len < 0)) {
+            ctx_send_str(c, "GET_ERR header\n");
+            return;
+        }
+        cmd_get(c, fname, off, len);
+        return;
+    }
+
+    // SENDTO <usuario> <nombre> <bytes>: el contenido va directo a esa sesión
+    if (strncasecmp(line, "SENDTO ", 7) == 0) {
+        char user[SD_USER], fname[256]; long long fsz = -1;
+        if (sscanf(line + 7, "%63s %255s %lld", user, fname, &fsz) != 3 || fsz < 0) {
+            // Sin tamaño no se sabe dónde acaba el contenido
+            ctx_send_str(c, "SENDTO_ERR header\n");
+            c->state = ST_CLOSE;
+            return;
+        }
+        cmd_sendto(c, user, fname, fsz);
+        return;
+    }
+
+    // COMPRESS lz: el cliente pregunta si puede usar FILEZ
+    if (strncasecmp(line, "COMPRESS ", 9) == 0) {
+        ctx_send_str(c, strcasecmp(line + 9, "lz") == 0 ? "COMPRESS_OK lz\n" : "COMPRESS_ERR\n");
+        return;
+    }
+
+    // FILEZ <nombre> <bytes> [crc32c]: el contenido llega en bloques comprimidos (lz.h)
+    if (strncasecmp(line, "FILEZ ", 6) == 0) {
+        char fname[256]; long long fsz = -1; uint32_t crc = 0;
+        int n = sscanf(line + 6, "%255s %lld %8x", fname, &fsz, &crc);
+        if (n < 2 || fsz < 0) {
+            // No se sabe dónde acaba el contenido: hay que cerrar
+            ctx_send(c, "FILE_ERR header\n", 16); c->state = ST_CLOSE;
+            return;
+        }
+        start_file(c, fname, fsz);
+        c->up.crc_want = n == 3; c->up.crc_expect = crc;
+        c->up.zbuf = (unsigned char*)malloc(LZ_HDR + LZ_BOUND(LZ_BLOCK) + LZ_BLOCK);
+        c->up.zhave = 0; c->up.zwire = 0;
+        if (!c->up.zbuf) { ctx_send_str(c, "FILE_ERR io\n"); c->state = ST_CLOSE; return; }
+        if (fsz == 0) finish_file(c);
+        return;
+    }
+
+    // Subidas reanudables
+    if (strncasecmp(line, "UPLOAD ", 7) == 0 || strncasecmp(line, "UPQUERY ", 8) == 0 ||
+        strncasecmp(line, "CHUNK ", 6) == 0 || strncasecmp(line, "UPDONE ", 7) == 0) {
+        char cmd[16], id[128], name[256]; long long a = -1, b = -1; int used = 0;
+        if (sscanf(line, "%15s %127s%n", cmd, id, &used) != 2 || !valid_upload_id(id)) {
+            ctx_send_str(c, "UPLOAD_ERR header\n");
+            if (strncasecmp(line, "CHUNK ", 6) == 0) c->state = ST_CLOSE;   // no se sabe cuánto contenido sigue
+            return;
+        }
+        const char *rest = line + used;
+        if (strcasecmp(cmd, "UPLOAD") == 0) {
+            if (sscanf(rest, "%255s %lld", name, &a) != 2 || a < 0) { ctx_send_str(c, "UPLOAD_ERR header\n"); return; }
+            cmd_upload(c, id, name, a);
+        } else if (strcasecmp(cmd, "CHUNK") == 0) {
+            // Sin cabecera válida no se sabe cuánto contenido viene: hay que cerrar
+            if (sscanf(rest, "%lld %lld", &a, &b) != 2 || a < 0 || b < 0) {
+                ctx_send_str(c, "UPLOAD_ERR header\n"); c->state = ST_CLOSE; return;
+            }
+            cmd_chunk(c, id, a, b);
+        } else if (strcasecmp(cmd, "UPDONE") == 0) {
+            cmd_updone(c, id);
+        } else {
+            upload_reply_have(c, id);
+        }
+        return;
+    }
+
+    // STATS (solo administradores)
+    if (strcasecmp(line, "STATS") == 0) {
+        if (!c->admin) { ctx_send_str(c, "STATS_ERR permiso\n"); return; }
+        char out[BUFFER_SIZE];
+        size_t n = met_format(out, sizeof(out) - 16, "STATS ");
+        n += pool_format(out + n, sizeof(out) - 16 - n, "STATS ");
+        n += (size_t)snprintf(out + n, sizeof(out) - n, "STATS_END\n");
+        ctx_send(c, out, n);
+        return;
+    }
+
+    // WHO [usuario]: sesiones abiertas en todo el servidor
+    if (strcasecmp(line, "WHO") == 0 || strncasecmp(line, "WHO ", 4) == 0) {
+        char user[SD_USER] = "";
+        if (line[3]) sscanf(line + 4, "%63s", user);
+        cmd_who(c, user);
+        return;
+    }
+
+    // BINARY: a partir de aquí, tramas (frame.h)
+    if (strcasecmp(line, "BINARY") == 0) {
+        ctx_send_str(c, "BINARY_OK\n");
+        c->binary = true;
+        room_set_binary(c);
+        return;
+    }
+
+    // Salas: JOIN <sala> (sale de la anterior), LEAVE, ROOMS
+    if (strncasecmp(line, "JOIN ", 5) == 0 || strcasecmp(line, "LEAVE") == 0 || strcasecmp(line, "ROOMS") == 0) {
+        cmd_room(c, line);
+        return;
+    }
+
+    // Mensaje normal
+    session_msg(c, line, strlen(line));
+}
+
+// Modo binario: una trama completa al principio de c->in. false si aún no ha llegado entera.
+static bool session_frame(client_ctx *c) {
+    if (rbuf_len(&c->in) < FRAME_HDR) return false;
+    unsigned char *h = (unsigned char*)rbuf_peek(&c->in);
+    uint32_t len = frame_len(h);
+    if (len > FRAME_MAX) { ctx_send_str(c, "FRAME_ERR longitud\n"); c->state = ST_CLOSE; return false; }
+    if (rbuf_len(&c->in) < FRAME_HDR + len) return false;
+    const char *p = (const char*)h + FRAME_HDR;
+    char tmp[FRAME_MAX + 1];
+    switch (h[0]) {
+    case FR_MSG:
+        session_msg(c, p, len);
+        break;
+    case FR_CMD:
+        memcpy(tmp, p, len); tmp[len] = '\0';
+        session_line(c, tmp);
+        break;
+    case FR_FILE:
+    case FR_FILE_CRC: {
+        size_t fixed = h[0] == FR_FILE_CRC ? 12 : 8;
+        uint64_t fsz = len >= fixed ? frame_get_u64((const unsigned char*)p) : 0;
+        size_t nl = len >= fixed ? len - fixed : 0;
+        if (len < fixed || nl == 0 || nl > 255 || fsz > (uint64_t)INT64_MAX) {
+            // Sin tamaño fiable no se sabe cuánto contenido sigue: hay que cerrar
+            ctx_send_str(c, "FILE_ERR header\n"); c->state = ST_CLOSE; break;
+        }
+        memcpy(tmp, p + fixed, nl); tmp[nl] = '\0';
+        start_file(c, tmp, (long long)fsz);
+        if (fixed == 12) { c->up.crc_want = true; c->up.crc_expect = frame_get_u32((const unsigned char*)p + 8); }
+        if (fsz == 0) finish_file(c);
+        break;
+    }
+    default:
+        ctx_send_str(c, "FRAME_ERR tipo\n"); c->state = ST_CLOSE;
+        break;
+    }
+    rbuf_consume(&c->in, FRAME_HDR + len);
+    return true;
+}
+
+// El buffer de entrada se toma del pool para leer y se devuelve en cuanto queda vacío.
+static bool in_attach(client_ctx *c) {
+    if (c->in.data) return true;
+    char *m = (char*)pool_get(&buf_pool, &buf_tc);
+    if (!m) return false;
+    rbuf_init(&c->in, m, BUFFER_SIZE + 1);
+    return true;
+}
+static void in_release(client_ctx *c) {
+    if (!c->in.data || rbuf_len(&c->in) > 0) return;
+    pool_put(&buf_pool, &buf_tc, c->in.data);
+    c->in.data = NULL;
+}
+
+// Procesa todo lo acumulado en c->in: líneas (o tramas) completas o contenido de FILE.
+// Las respuestas de todo el lote salen juntas al final.
+static void session_consume(client_ctx *c) {
+    c->corked = true;
+    while (c->state != ST_CLOSE && rbuf_len(&c->in) > 0) {
+        if (ctx_input_blocked(c)) {
+            // GET en curso (lo siguiente va detrás del contenido) o cola llena. En fork el
+            // envío bloquea hasta el final; en epoll, si no cabe, se sigue en EPOLLOUT.
+            if (ctx_flush(c) != 0) { c->state = ST_CLOSE; break; }
+            if (ctx_input_blocked(c)) break;
+            continue;
+        }
+        if (c->state == ST_FILE && c->up.zbuf) {
+            rbuf_consume(&c->in, receive_z(c, rbuf_peek(&c->in), rbuf_len(&c->in)));
+            continue;
+        }
+        if (c->state == ST_FILE) {
+            size_t take = rbuf_len(&c->in);
+            if ((long long)take > c->up.left) take = (size_t)c->up.left;
+            receive_file(c, rbuf_peek(&c->in), take);
+            rbuf_consume(&c->in, take);
+            continue;
+        }
+        if (c->state == ST_RELAY) {
+            size_t take = rbuf_len(&c->in);
+            if ((long long)take > c->rl.left) take = (size_t)c->rl.left;
+            relay_src_data(c, rbuf_peek(&c->in), take);
+            rbuf_consume(&c->in, take);
+            continue;
+        }
+        if (c->binary) {
+            if (!session_frame(c)) break;
+            continue;
+        }
+        char *line = rbuf_line(&c->in, NULL);
+        if (!line) break;
+        rstrip_newline(line);
+        session_line(c, line);
+    }
+    c->corked = false;
+    if (!ctx_out_empty(c) && ctx_flush(c) != 0) c->state = ST_CLOSE;
+    in_release(c);
+}
+
+// Un recv() sobre el socket. Devuelve >0 bytes leídos, 0 en desconexión, -1 en error/EAGAIN.
+static ssize_t session_read(client_ctx *c) {
+    if (ctx_input_blocked(c)) { errno = EAGAIN; return -1; }   // epoll: espera al GET o a vaciar la cola
+    if (zerocopy && !c->up.wbuf && !c->up.splice_off && c->state == ST_FILE && c->up.fd >= 0 && !c->up.zbuf && !c->up.crc_want && !c->up.sha_on &&
+        rbuf_len(&c->in) == 0) {
+        ssize_t n = splice_file_chunk(c);
+        if (!c->up.splice_off) {
+            ctx_bytes_in(c, n);
+            return n;
+        }
+    }
+    if (c->state == ST_FILE && c->up.zbuf && c->up.zhave >= LZ_HDR && rbuf_len(&c->in) == 0) {
+        ssize_t n = receive_z_direct(c);
+        ctx_bytes_in(c, n);
+        return n;
+    }
+    if (c->state == ST_FILE && !c->up.zbuf && rbuf_len(&c->in) == 0) {
+        ssize_t n = receive_file_direct(c);
+        ctx_bytes_in(c, n);
+        return n;
+    }
+    if (c->state == ST_RELAY && c->rl.src && rbuf_len(&c->in) == 0) {
+        ssize_t n = relay_splice_in(c);
+        if (c->rl.src || n >= 0) return n;  // sin receptor (EPIPE): se descarta por el rbuf
+    }
+    if (!in_attach(c)) { errno = ENOMEM; return -1; }
+    ssize_t r = rbuf_fill(&c->in, c->sock);
+    ctx_bytes_in(c, r);
+    if (r > 0) session_consume(c);
+    else in_release(c);
+    return r;
+}
+static void session_eof(client_ctx *c) {
+    if (c->state == ST_FILE) file_commit(c);
+    if (c->state == ST_FILE && c->up.id[0]) chunk_record(c);   // lo recibido se conserva
+    // uring: con el write enlazado aún pendiente, el fd se cierra al liberar la conexión (el
+    // kernel lo resuelve al ejecutarlo, y ese número podría ser ya otro fichero)
+    if (c->state == ST_FILE && c->up.fd >= 0 && !c->ur.in) file_fail(c);
+    if (c->state == ST_CHAT || c->state == ST_FILE || c->state == ST_RELAY) {
+        alog("[DESCONECTADO] %s @ %s\n", ctx_user(c), c->ipport);
+    }
+    c->state = ST_CLOSE;
+}
+
+// --- Plazos: AUTH, inactividad y transferencias ---
+// AUTH cuenta desde la conexión (enviar un byte de vez en cuando no lo alarga); el chat,
+// desde lo último recibido; un FILE/CHUNK, desde el último byte recibido y un GET o una
+// cola llena, desde el último byte que aceptó el socket. Mientras no se lee la conexión
+// (GET en curso o cola pausada) no cuentan los plazos de entrada.
+enum { TO_NONE, TO_AUTH, TO_IDLE, TO_XFER, TO_SLOW };
+static const char *to_names[] = { "", "auth", "inactividad", "transferencia", "cola" };
+
+static void to_min(uint64_t *d, int *why, uint64_t t, int k) {
+    if (!*d || t < *d) { *d = t; *why = k; }
+}
+// Tick en el que vence la conexión (0 si no tiene plazo) y el motivo.
+static uint64_t ctx_deadline(const client_ctx *c, int *why) {
+    uint64_t d = 0;
+    *why = TO_NONE;
+    if (c->state == ST_AUTH && auth_timeout) to_min(&d, why, c->t_accept + TICKS(auth_timeout), TO_AUTH);
+    if (!ctx_input_blocked(c)) {
+        if (c->state == ST_CHAT && idle_timeout) to_min(&d, why, c->last_in + TICKS(idle_timeout), TO_IDLE);
+        if (c->state == ST_FILE && xfer_timeout) to_min(&d, why, c->last_in + TICKS(xfer_timeout), TO_XFER);
+        if (c->state == ST_RELAY && xfer_timeout) {
+            // Con el pipe lleno no llega nada: mientras el receptor avance no está parado
+            uint64_t t = c->last_in;
+            if (c->rl.src) {
+                uint64_t r = atomic_load_explicit(&c->rl.src->tick, memory_order_relaxed);
+                if (r > t) t = r;
+            }
+            to_min(&d, why, t + TICKS(xfer_timeout), TO_XFER);
+        }
+    }
+    if (xfer_timeout && (c->get_fd >= 0 || (c->state == ST_CLOSE && !ctx_out_empty(c))))
+        to_min(&d, why, c->last_out + TICKS(xfer_timeout), TO_XFER);
+    if (c->paused && slow_policy == SLOW_CLOSE)
+        to_min(&d, why, c->over_since / TICK_NS + TICKS(slow_grace), TO_SLOW);
+    return d;
+}
+// Vencido: aviso (si el cliente aún lee) y cierre como en una desconexión.
+static void ctx_timeout(client_ctx *c, int why) {
+    if (why == TO_SLOW) { ctx_evict(c, "por encima de --out-high demasiado tiempo"); return; }
+    met_add(M_TIMEOUTS, 1);
+    alog("[TIMEOUT] %s @ %s: %s\n", ctx_user(c), c->ipport, to_names[why]);
+    if (c->state != ST_CLOSE && !ctx_input_blocked(c)) {
+        char msg[64]; snprintf(msg, sizeof(msg), "TIMEOUT %s\n", to_names[why]);
+        ctx_send_str(c, msg);
+    }
+    session_eof(c);
+}
+// epoll: tras cada evento. Solo se adelanta el temporizador; si el plazo se alargó, al
+// vencer se recalcula y se vuelve a armar (armar y cancelar son O(1), pero así una
+// conexión activa no toca la rueda en cada lectura).
+static void ctx_timer_update(client_ctx *c) {
+    int why;
+    uint64_t d = ctx_deadline(c, &why);
+    twheel *w = &c->shard->tw;
+    if (!d) tw_cancel(w, &c->tmr);
+    else if (!tw_armed(&c->tmr) || d < c->tmr.expires) tw_arm(w, &c->tmr, d);
+}
+static void ctx_timer_fire(tw_timer *t, void *arg) {
+    client_ctx *c = (client_ctx*)((char*)t - offsetof(client_ctx, tmr));
+    twheel *w = &((worker*)arg)->tw;
+    // uring: cerrada con un envío que no termina (el cliente no lee): se corta del todo
+    if (c->ur.dead) { shutdown(c->sock, SHUT_RDWR); return; }
+    int why;
+    uint64_t d = ctx_deadline(c, &why);
+    if (!d) return;
+    if (d > w->now) { tw_arm(w, t, d); return; }
+    ctx_timeout(c, why);
+    ctx_free(c);
+}
+
+// --- Reinicio en caliente (SIGUSR2) ---
+// El proceso actual lanza su sucesor con fork() + execv() del binario en disco, mismos
+// argumentos y "--takeover <fd>", donde fd es su extremo de un socketpair SOCK_SEQPACKET
+// (un mensaje por registro, sin delimitar):
+//   viejo -> nuevo  "LISTEN tcp,tcp,unix"          + los listeners (SCM_RIGHTS), con el tipo de cada uno en orden
+//   nuevo -> viejo  "READY"                        ya acepta: el viejo cierra los suyos
+//   viejo -> nuevo  "CONN usuario admin bin sala entrada"  + el socket (solo con --handover-conns)
+//   viejo -> nuevo  "END"
+// Los sockets escuchando son los mismos en los dos procesos: lo que llega mientras tanto
+// espera en su cola y lo acepta uno u otro, nunca se rechaza.
+// El directorio de sesiones (WHO) es de cada proceso: el sucesor solo ve las suyas y las
+// que recibe; las que siguen en el anterior (o en sus hijos de fork) no salen en su WHO.
+#define HR_MAXFDS 253              // SCM_MAX_FD del kernel
+static char self_exe[PATH_MAX];
+static char **self_argv;
+static int takeover_fd = -1;       // --takeover: somos el sucesor
+static bool handover_conns = false;    // --handover-conns
+static atomic_bool draining;       // el sucesor ya acepta: cerrar listeners y salir al vaciarse
+static int hr_sock = -1;           // con el sucesor, mientras se le entregan conexiones
+static pthread_mutex_t hr_mu = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int hr_done;         // workers que ya entregaron lo suyo
+static atomic_bool hr_exit;        // sin conexiones en ningún worker: todos salen de su bucle
+
+// Sesión recibida del anterior camino del buzón de su worker, que crea allí su client_ctx:
+// con la caché del slab, los contadores y el reloj (loop_tick) de ese hilo.
+typedef struct hr_conn {
+    int fd, family, admin, binary;
+    long long login;
+    char user[256], room[64];      // room "-": fuera de sala
+    struct hr_conn *next;
+} hr_conn;
+
+static int hr_send(int s, const char *msg, const int *fds, int nfds) {
+    struct iovec iov = { (void*)msg, strlen(msg) };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+    char *cbuf = NULL;
+    if (nfds > 0) {
+        size_t sz = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+        if (!(cbuf = (char*)calloc(1, sz))) return -1;
+        mh.msg_control = cbuf; mh.msg_controllen = sz;
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET; cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * (size_t)nfds);
+    }
+    ssize_t r;
+    do r = sendmsg(s, &mh, MSG_NOSIGNAL); while (r < 0 && errno == EINTR);
+    free(cbuf);
+    return r < 0 ? -1 : 0;
+}
+// Un registro (terminado en '\0') y hasta maxfds descriptores (los de más se cierran).
+// Devuelve su longitud, 0 si el otro cerró, -1 en error o con descriptores truncados.
+static ssize_t hr_recv(int s, char *buf, size_t cap, int *fds, int maxfds, int *nfds) {
+    char cbuf[CMSG_SPACE(sizeof(int) * HR_MAXFDS)];
+    struct iovec iov = { buf, cap - 1 };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = cbuf, .msg_controllen = sizeof(cbuf) };
+    ssize_t r;
+    do r = recvmsg(s, &mh, MSG_CMSG_CLOEXEC); while (r < 0 && errno == EINTR);
+    *nfds = 0;
+    if (r < 0) return -1;
+    buf[r] = '\0';
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int n = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < n; i++) {
+            int fd; memcpy(&fd, CMSG_DATA(cm) + sizeof(int) * (size_t)i, sizeof(int));
+            if (*nfds < maxfds) fds[(*nfds)++] = fd;
+            else close(fd);
+        }
+    }
+    if (mh.msg_flags & MSG_CTRUNC) {
+        fprintf(stderr, "relevo: descriptores truncados en \"%s\"\n", buf);
+        for (int i = 0; i < *nfds; i++) close(fds[i]);
+        *nfds = 0;
+        return -1;
+    }
+    return r;
+}
+// Lanza el sucesor y le pasa los listeners. Devuelve el socket con él cuando ya ha
+// contestado READY, o -1 (y se sigue sirviendo como si nada) si no llegó a arrancar.
+static int hr_spawn(const int *lfds, int n) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) { perror("socketpair"); return -1; }
+    int argc = 0;
+    while (self_argv[argc]) argc++;
+    char **av = (char**)calloc((size_t)argc + 3, sizeof(char*));
+    if (!av) { close(sv[0]); close(sv[1]); return -1; }
+    char fdstr[16]; snprintf(fdstr, sizeof(fdstr), "%d", sv[1]);
+    int k = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(self_argv[i], "--takeover") == 0) { i++; continue; }   // el nuestro, si también heredamos
+        if (strncmp(self_argv[i], "--takeover=", 11) == 0) continue;
+        av[k++] = self_argv[i];
+    }
+    av[k++] = (char*)"--takeover"; av[k++] = fdstr; av[k] = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Entre fork() y exec() solo llamadas seguras: el proceso tiene más hilos
+        sigset_t none; sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        fcntl(sv[1], F_SETFD, 0);
+        execv(self_exe, av);
+        _exit(127);
+    }
+    free(av);
+    close(sv[1]);
+    if (pid < 0) { perror("fork"); close(sv[0]); return -1; }
+    char buf[64], rec[8 + 5 * HR_MAXFDS]; int fds[1], nfds;
+    size_t len = (size_t)snprintf(rec, sizeof(rec), "LISTEN");
+    for (int i = 0; i < n; i++)
+        len += (size_t)snprintf(rec + len, sizeof(rec) - len, "%c%s", i ? ',' : ' ', lfds[i] == unix_fd ? "unix" : "tcp");
+    struct timeval tv = { .tv_sec = 10, .tv_usec = 0 };
+    setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ssize_t r = hr_send(sv[0], rec, lfds, n) != 0 ? -1 : hr_recv(sv[0], buf, sizeof(buf), fds, 1, &nfds);
+    if (r > 0 && nfds) close(fds[0]);              // READY no lleva descriptores
+    if (r <= 0 || strcmp(buf, "READY") != 0) {
+        alog("[RELEVO] el sucesor (%s, pid %d) no arrancó: se sigue sirviendo\n", self_exe, (int)pid);
+        kill(pid, SIGTERM);
+        close(sv[0]);
+        return -1;
+    }
+    alog("[RELEVO] el sucesor (pid %d) ya acepta en el puerto %d: se dejan de aceptar conexiones\n", (int)pid, PORT);
+    return sv[0];
+}
+// Sucesor: recibe los listeners, los TCP en lfds y el AF_UNIX (o -1) en *ufd. Devuelve
+// cuántos TCP. Un "LISTEN" sin tipos (versión anterior) son todos TCP.
+static int hr_inherit(int *lfds, int *ufd) {
+    char buf[8 + 5 * HR_MAXFDS], *tags = NULL, *save = NULL; int fds[HR_MAXFDS], n, k = 0;
+    *ufd = -1;
+    ssize_t r = hr_recv(takeover_fd, buf, sizeof(buf), fds, HR_MAXFDS, &n);
+    bool ok = r > 0 && (strcmp(buf, "LISTEN") == 0 || (strncmp(buf, "LISTEN ", 7) == 0 && (tags = buf + 7)));
+    char *tag = tags ? strtok_r(tags, ",", &save) : NULL;
+    for (int i = 0; ok && i < n; i++, tag = tags ? strtok_r(NULL, ",", &save) : NULL) {
+        if (tags && !tag) ok = false;
+        else if (tag && strcmp(tag, "unix") == 0 && *ufd < 0) *ufd = fds[i];
+        else if (!tag || strcmp(tag, "tcp") == 0) lfds[k++] = fds[i];
+        else ok = false;
+    }
+    if (!ok || k == 0) {
+        fprintf(stderr, "--takeover: no se recibieron los listeners\n");
+        for (int i = 0; i < n; i++) close(fds[i]);
+        *ufd = -1;
+        return -1;
+    }
+    return k;
+}
+static void hr_ready(void) {
+    if (hr_send(takeover_fd, "READY", NULL, 0) != 0) perror("--takeover");
+}
+
+// --- Modo fork: proceso hijo + pthread bloqueante ---
+// Los plazos se esperan con poll() antes de cada lectura (cada session_read() hace una sola).
+static void *client_thread(void *arg) {
+    client_ctx *ctx = (client_ctx*)arg;
+    while (ctx->state != ST_CLOSE) {
+        int why;
+        uint64_t d = ctx_deadline(ctx, &why), now = tick_now();
+        if (d) {
+            struct pollfd p = { .fd = ctx->sock, .events = POLLIN };
+            int r = poll(&p, 1, d > now ? (int)((d - now) * (TICK_NS / 1000000)) : 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r == 0) { ctx_timeout(ctx, why); break; }
+        }
+        ssize_t n = session_read(ctx);
+        if (n > 0) ctx->last_in = tick_now();
+        if (n == 0) { session_eof(ctx); break; }
+        if (n < 0) { perror("recv"); break; }
+    }
+    ctx_free(ctx);
+    return NULL;
+}
+
+// Cada conexión vive en su propio hijo: en un relevo solo hay que pasar el listener, y
+// el padre puede salir en cuanto el sucesor acepta (los hijos siguen hasta acabar).
+static volatile sig_atomic_t hr_requested = 0;
+static void on_sigusr2(int sig) { (void)sig; hr_requested = 1; }
+
+static void fork_loop(int server_fd) {
+    while (1) {
+        if (hr_requested) {
+            hr_requested = 0;
+            int lfds[2] = { server_fd, unix_fd };
+            int s = hr_spawn(lfds, unix_fd >= 0 ? 2 : 1);
+            if (s >= 0) {
+                hr_send(s, "END", NULL, 0);
+                close(s);
+                alog("[RELEVO] fin del proceso padre; las conexiones abiertas siguen en sus hijos\n");
+                return;
+            }
+        }
+        int lfd = server_fd;
+        if (unix_fd >= 0) {
+            struct pollfd lp[2] = { { .fd = server_fd, .events = POLLIN }, { .fd = unix_fd, .events = POLLIN } };
+            if (poll(lp, 2, -1) < 0) { if (errno != EINTR) perror("poll"); continue; }
+            if (lp[1].revents & POLLIN) lfd = unix_fd;
+        }
+        struct sockaddr_storage cliaddr; socklen_t clilen = sizeof(cliaddr);
+        int new_sock = accept(lfd, (struct sockaddr*)&cliaddr, &clilen);
+        if (new_sock < 0) { if (errno == EINTR) continue; perror("accept"); continue; }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork"); close(new_sock); continue;
+        } else if (pid == 0) {
+            // Hijo
+            close(server_fd);
+            if (unix_fd >= 0) close(unix_fd);
+            alog_after_fork();
+
+            client_ctx *ctx = ctx_new(new_sock, lfd == unix_fd ? AF_UNIX : AF_INET, &cliaddr, false);
+            if (!ctx) { close(new_sock); exit(EXIT_FAILURE); }
+            // Sin cola que crezca: un send() bloqueado más de slow_grace es un cliente que no lee
+            if (slow_policy == SLOW_CLOSE) {
+                struct timeval tv = { .tv_sec = slow_grace, .tv_usec = 0 };
+                setsockopt(new_sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            }
+
+            pthread_t th;
+            if (pthread_create(&th, NULL, client_thread, ctx) != 0) {
+                perror("pthread_create"); ctx_free(ctx); exit(EXIT_FAILURE);
+            }
+            pthread_join(th, NULL);
+            exit(EXIT_SUCCESS);
+        } else {
+            // Padre (el hijo numeró la suya con unix_conns + 1: la siguiente, una más)
+            if (lfd == unix_fd) atomic_fetch_add(&unix_conns, 1);
+            close(new_sock);
+        }
+    }
+}
+
+// --- Modo epoll: edge-triggered, sockets no bloqueantes (uno o varios workers) ---
+static int set_nonblocking(int fd) {
+    int fl = fcntl(fd, F_GETFL, 0);
+    return (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0) ? -1 : 0;
+}
+
+static void epoll_accept(int ep, worker *w, int lfd) {
+    while (1) {
+        struct sockaddr_storage cliaddr; socklen_t clilen = sizeof(cliaddr);
+        int s = accept4(lfd, (struct sockaddr*)&cliaddr, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (s < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        client_ctx *c = ctx_new(s, lfd == unix_fd ? AF_UNIX : AF_INET, &cliaddr, true);
+        if (!c) { close(s); continue; }
+        c->shard = w;
+        conn_link(w, c);
+        atomic_fetch_add_explicit(&w->accepted, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&w->active, 1, memory_order_relaxed);
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, s, &ev) < 0) { perror("epoll_ctl"); ctx_free(c); continue; }
+        ctx_timer_update(c);
+    }
+}
+
+// Lo que toca hacer con los eventos de una conexión. true si hay que liberarla.
+static bool epoll_conn_io(client_ctx *c, uint32_t events) {
+    bool dead = false;
+    if ((events & EPOLLOUT) && ctx_input_blocked(c)) {
+        // Al acabar un GET o bajar la cola hay que retomar la entrada que se dejó esperando
+        // (en el rbuf y en el socket, cuyo EPOLLIN edge-triggered ya pasó)
+        if (ctx_flush(c) != 0) dead = true;
+        else if (!ctx_input_blocked(c)) { session_consume(c); events |= EPOLLIN; }
+    }
+    if (!dead && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        // Edge-triggered: leer hasta EAGAIN
+        while (c->state != ST_CLOSE) {
+            ssize_t n = session_read(c);
+            if (n > 0) { c->last_in = loop_tick; continue; }
+            if (n == 0) { session_eof(c); dead = true; }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK) { perror("recv"); dead = true; }
+            break;
+        }
+    }
+    if (!dead && (events & EPOLLOUT) && ctx_flush(c) != 0) dead = true;
+    return dead || (c->state == ST_CLOSE && (ctx_out_empty(c) || (events & (EPOLLHUP | EPOLLERR))));
+}
+static void epoll_conn_event(client_ctx *c, uint32_t events) {
+    if (epoll_conn_io(c, events)) ctx_free(c);
+    else ctx_timer_update(c);
+}
+// Evento de un extremo del pipe de un SENDTO: la conexión de ese lado sigue leyendo o
+// enviando donde lo dejó, o el emisor que esperaba el resultado responde. Como en el
+// buzón, aquí no se libera: su socket puede tener un evento detrás en este lote.
+static void relay_event(uint64_t tag) {
+    relay *rl = (relay*)(uintptr_t)(tag & ~(uint64_t)3);
+    client_ctx *c = (int)(tag & 3) - 1 == RL_SRC ? rl->src : rl->dst;
+    if (!c) return;                    // ese lado ya lo soltó
+    if (c->rl.wait && relay_src_done(c) && c->in.data) session_consume(c);
+    if (epoll_conn_io(c, EPOLLIN | EPOLLOUT)) {
+        c->state = ST_CLOSE;
+        shutdown(c->sock, SHUT_RDWR);
+    } else ctx_timer_update(c);
+}
+
+// Segmentos de sala que otros hilos (o este) dejaron en el buzón: primero se encolan todos
+// y después cada conexión afectada se vacía una vez, con todos sus mensajes en un writev().
+// Un destinatario por encima de out_high recibe según --slow-policy: drop descarta el
+// mensaje; close lo encola, pero si pasa de out_max se le desconecta (y si lleva más de
+// slow_grace s sin bajar, lo desconecta su temporizador).
+// Aquí no se libera ninguna: puede tener un evento detrás en el mismo epoll_wait(). Si hay
+// que cerrarla, shutdown() y la libera su propio evento (EPOLLHUP). En uring sí: mientras
+// tenga operaciones en curso ctx_free() solo la marca y sus CQEs la siguen encontrando.
+static void uring_recv(client_ctx *c);
+static bool uring_detach(client_ctx *c);
+static void uring_unlisten(worker *w);
+static void mailbox_drain(worker *w) {
+    uint64_t v;
+    if (read(w->mb_fd, &v, sizeof(v)) < 0 && errno != EAGAIN) perror("eventfd");
+    pthread_mutex_lock(&w->mb_mu);
+    oseg *s = w->mb_head;
+    w->mb_head = w->mb_tail = NULL;
+    hr_conn *adopt = w->adopt;
+    w->adopt = NULL;
+    relay *offers = w->rl_offers;
+    w->rl_offers = NULL;
+    pthread_mutex_unlock(&w->mb_mu);
+    // Relevo: sesiones que entregó el proceso anterior (antes que sus mensajes de sala)
+    while (adopt) {
+        hr_conn *h = adopt;
+        adopt = h->next;
+        client_ctx *c = ctx_new(h->fd, h->family, NULL, true);
+        if (!c) {
+            close(h->fd);
+            atomic_fetch_sub_explicit(&w->active, 1, memory_order_relaxed);
+            free(h);
+            continue;
+        }
+        c->shard = w;
+        snprintf(c->user, sizeof(c->user), "%s", h->user);
+        c->admin = h->admin; c->binary = h->binary;
+        c->state = ST_CHAT;
+        met_add(M_SESSIONS, 1);
+        c->dslot = sd_claim(&sessions, c->user, c->ipport, h->login);
+        conn_link(w, c);
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+        if (!w->ur && epoll_ctl(w->ep, EPOLL_CTL_ADD, c->sock, &ev) < 0) { perror("epoll_ctl"); ctx_free(c); free(h); continue; }
+        if (strcmp(h->room, "-") != 0) room_join(c, h->room);
+        free(h);
+        online_add(c);
+        if (w->ur) uring_recv(c);
+        ctx_timer_update(c);
+    }
+    client_ctx *dirty = NULL;
+    // SENDTO: cabecera y contenido salen con el resto de lo que tenga en la cola
+    while (offers) {
+        relay *rl = offers;
+        offers = rl->offer_next;
+        client_ctx *c = rl->dst;
+        relay_accept(w, rl);
+        if (!c->mb_dirty) { c->mb_dirty = true; c->mb_next = dirty; dirty = c; }
+    }
+    while (s) {
+        oseg *next = s->next;
+        client_ctx *c = (client_ctx*)s->to;
+        bool over = c->oq_bytes > out_high;
+        if (c->evicted || (over && slow_policy == SLOW_DROP)) {
+            if (!c->evicted) met_add(M_ROOM_DROPS, 1);
+            obuf_put(s->b); free(s);
+        } else {
+            ctx_link(c, s);
+            if (c->oq_bytes > out_max) ctx_evict(c, "cola por encima de --out-max");
+        }
+        if (!c->mb_dirty) { c->mb_dirty = true; c->mb_next = dirty; dirty = c; }
+        s = next;
+    }
+    while (dirty) {
+        client_ctx *c = dirty;
+        dirty = c->mb_next;
+        c->mb_dirty = false;
+        bool failed = c->evicted || ctx_flush(c) != 0;
+        if (failed) c->state = ST_CLOSE;
+        if (failed || (c->state == ST_CLOSE && ctx_out_empty(c))) {
+            if (w->ur) ctx_free(c);
+            else shutdown(c->sock, SHUT_RDWR);
+        } else ctx_timer_update(c);
+    }
+}
+
+// Relevo en epoll/uring, en cada worker tras ver draining: cierra su listener, entrega (con
+// --handover-conns) las sesiones de chat sin nada pendiente en ningún sentido, y el último
+// en terminar manda END. Después sigue atendiendo lo que le queda; cuando no queda ninguna
+// conexión en ningún worker, despierta a todos y devuelve true: el worker sale de su bucle
+// y main() sale del proceso tras esperarlos (no exit() con los demás hilos en marcha).
+static bool hr_drain(worker *w) {
+    if (!w->drained) {
+        w->drained = true;
+        if (w->ur) uring_unlisten(w);
+        else {
+            epoll_ctl(w->ep, EPOLL_CTL_DEL, w->listen_fd, NULL);
+            if (unix_fd >= 0) epoll_ctl(w->ep, EPOLL_CTL_DEL, unix_fd, NULL);
+        }
+        close(w->listen_fd);
+        w->listen_fd = -1;
+        int moved = 0;
+        for (client_ctx *c = w->conns, *next; handover_conns && c; c = next) {
+            next = c->w_next;
+            if (c->state != ST_CHAT || c->in.data || !ctx_out_empty(c) || c->paused || c->evicted) continue;
+            if (w->ur && !uring_detach(c)) continue;       // su recv ya trajo algo: se queda
+            char rec[400];
+            snprintf(rec, sizeof(rec), "CONN %s %d %d %s %lld", c->user, c->admin, c->binary, c->rm.room ? c->rm.room->name : "-",
+                     c->dslot ? (long long)c->dslot->login : (long long)time(NULL));
+            pthread_mutex_lock(&hr_mu);
+            int r = hr_sock >= 0 ? hr_send(hr_sock, rec, &c->sock, 1) : -1;
+            pthread_mutex_unlock(&hr_mu);
+            if (r != 0) { c->hr.handoff = false; break; }     // uring: su recv cancelado vuelve y se rearma
+            // El socket sigue abierto en el sucesor y epoll sigue la descripción, no el
+            // número: sin el DEL seguirían llegando aquí sus eventos tras el close()
+            if (!w->ur) epoll_ctl(w->ep, EPOLL_CTL_DEL, c->sock, NULL);
+            ctx_free(c);
+            moved++;
+        }
+        if (moved) alog("[RELEVO] worker %d: %d sesiones entregadas al sucesor\n", w->id, moved);
+        if (atomic_fetch_add(&hr_done, 1) + 1 == nworkers) {
+            if (unix_fd >= 0) { close(unix_fd); unix_fd = -1; }    // ya fuera de todos los workers
+            pthread_mutex_lock(&hr_mu);
+            hr_send(hr_sock, "END", NULL, 0);
+            close(hr_sock);
+            hr_sock = -1;
+            pthread_mutex_unlock(&hr_mu);
+        }
+    }
+    if (atomic_load(&hr_exit)) return true;
+    unsigned long left = 0;
+    for (int i = 0; i < nworkers; i++) left += atomic_load_explicit(&workers[i].active, memory_order_relaxed);
+    if (left == 0 && atomic_load(&hr_done) == nworkers && !atomic_exchange(&hr_exit, true)) {
+        alog("[RELEVO] sin conexiones: fin del proceso anterior\n");
+        for (int i = 0; i < nworkers; i++) {
+            uint64_t one = 1;
+            if (write(workers[i].mb_fd, &one, sizeof(one)) < 0) perror("eventfd");
+        }
+    }
+    return atomic_load(&hr_exit);
+}
+// SIGUSR2 (desde shard_stats_thread): lanza el sucesor y, si arranca, despierta a los workers.
+static void hr_start(void) {
+    if (atomic_load(&draining)) return;
+    int lfds[HR_MAXFDS];
+    if (nworkers + 1 > HR_MAXFDS) { alog("[RELEVO] demasiados workers para un relevo (%d)\n", nworkers); return; }
+    int n = 0;
+    for (int i = 0; i < nworkers; i++) lfds[n++] = workers[i].listen_fd;
+    if (unix_fd >= 0) lfds[n++] = unix_fd;         // --unix: el último
+    int s = hr_spawn(lfds, n);
+    if (s < 0) return;
+    hr_sock = s;
+    atomic_store(&draining, true);
+    for (int i = 0; i < nworkers; i++) {
+        uint64_t one = 1;
+        if (write(workers[i].mb_fd, &one, sizeof(one)) < 0) perror("eventfd");
+    }
+}
+// Sucesor: recibe las sesiones y las reparte entre los workers; cada uno crea su client_ctx
+// y la registra al vaciar el buzón. Ya cuentan como activas del worker desde aquí, para que
+// un relevo del sucesor no termine con alguna aún en un buzón.
+static void *hr_adopt_thread(void *arg) {
+    (void)arg;
+    char rec[400]; int fds[HR_MAXFDS], nfds, got = 0, rr = 0;
+    while (hr_recv(takeover_fd, rec, sizeof(rec), fds, HR_MAXFDS, &nfds) > 0) {
+        if (strcmp(rec, "END") == 0) { for (int i = 0; i < nfds; i++) close(fds[i]); break; }
+        hr_conn *h = nfds == 1 ? (hr_conn*)calloc(1, sizeof(*h)) : NULL;
+        if (h) h->login = (long long)time(NULL);
+        if (!h || sscanf(rec, "CONN %255s %d %d %63s %lld", h->user, &h->admin, &h->binary, h->room, &h->login) < 4) {
+            for (int i = 0; i < nfds; i++) close(fds[i]);
+            free(h);
+            continue;
+        }
+        h->fd = fds[0];
+        h->family = AF_INET; socklen_t flen = sizeof(h->family);
+        getsockopt(h->fd, SOL_SOCKET, SO_DOMAIN, &h->family, &flen);     // puede venir del listener AF_UNIX
+        worker *w = &workers[rr++ % nworkers];
+        atomic_fetch_add_explicit(&w->active, 1, memory_order_relaxed);
+        pthread_mutex_lock(&w->mb_mu);
+        h->next = w->adopt;
+        w->adopt = h;
+        pthread_mutex_unlock(&w->mb_mu);
+        uint64_t one = 1;
+        if (write(w->mb_fd, &one, sizeof(one)) < 0) perror("eventfd");
+        got++;
+    }
+    if (got) alog("[RELEVO] %d sesiones recibidas del proceso anterior\n", got);
+    close(takeover_fd);
+    takeover_fd = -1;
+    return NULL;
+}
+
+static void worker_pin(worker *w) {
+    if (w->cpu < 0) return;
+    cpu_set_t set; CPU_ZERO(&set); CPU_SET(w->cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) fprintf(stderr, "worker %d: no se pudo fijar a la CPU %d: %s\n", w->id, w->cpu, strerror(rc));
+}
+
+static void *epoll_loop(void *arg) {
+    worker *w = (worker*)arg;
+    worker_pin(w);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) { perror("epoll_create1"); exit(EXIT_FAILURE); }
+    w->ep = ep;
+    if (set_nonblocking(w->listen_fd) < 0) { perror("fcntl"); exit(EXIT_FAILURE); }
+    struct epoll_event lev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, w->listen_fd, &lev) < 0) { perror("epoll_ctl"); exit(EXIT_FAILURE); }
+    struct epoll_event mev = { .events = EPOLLIN | EPOLLET, .data.ptr = w };
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, w->mb_fd, &mev) < 0) { perror("epoll_ctl"); exit(EXIT_FAILURE); }
+    // --unix: un solo listener en el epoll de todos; EPOLLEXCLUSIVE despierta a uno por conexión
+    struct epoll_event uev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &unix_fd };
+    if (unix_fd >= 0 && (set_nonblocking(unix_fd) < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, unix_fd, &uev) < 0)) {
+        perror("epoll_ctl"); exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event evs[MAX_EVENTS];
+    loop_tick = tick_now();
+    tw_init(&w->tw, loop_tick);
+    while (1) {
+        // Con temporizadores armados se despierta cada tick para hacer avanzar la rueda
+        int n = epoll_wait(ep, evs, MAX_EVENTS, w->tw.armed ? (int)(TICK_NS / 1000000) : -1);
+        loop_tick = tick_now();
+        if (n < 0) { if (errno == EINTR) continue; perror("epoll_wait"); break; }
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.ptr == NULL) epoll_accept(ep, w, w->listen_fd);
+            else if (evs[i].data.ptr == &unix_fd) epoll_accept(ep, w, unix_fd);
+            else if (evs[i].data.ptr == w) mailbox_drain(w);
+            else if (evs[i].data.u64 & 3) relay_event(evs[i].data.u64);
+            else epoll_conn_event((client_ctx*)evs[i].data.ptr, evs[i].events);
+        }
+        relay_reap(w);
+        tw_advance(&w->tw, loop_tick, ctx_timer_fire, w);
+        atomic_store_explicit(&w->timers, w->tw.armed, memory_order_relaxed);
+        if (atomic_load_explicit(&draining, memory_order_acquire) && hr_drain(w)) break;
+    }
+    close(ep);
+    return NULL;
+}
+
+// --- Modo uring: la misma máquina de estados con la E/S por io_uring (uring.h) ---
+// Cada worker tiene su anillo; lo que se pide durante una vuelta del bucle (recv que
+// rearmar, envíos, splice de un GET) sale junto en el io_uring_enter() que espera la siguiente.
+// - accept multishot: una sola SQE mientras el listener siga abierto.
+// - recv con buffers provistos: el kernel elige el buffer al llegar los datos, así una
+//   conexión en reposo no tiene ninguno. Las líneas se copian al rbuf; el contenido de
+//   FILE/FILEZ se procesa directamente desde el buffer.
+// - FILE sin CRC, SHA-256 ni escrituras agrupadas (donde epoll usaría splice): recv directo
+//   a un buffer de FILE_BUF y, con lo que haya llegado, el write al fichero. Sin MSG_WAITALL
+//   ni enlace: lo que llega cuenta ya para el plazo de --xfer-timeout (un recv enlazado que
+//   vuelve corto no corta la cadena y el write escribiría el buffer entero).
+// - Salida: un sendmsg con hasta IOV_BATCH segmentos de la cola; lo que se encole mientras
+//   está en curso sale junto en el siguiente. GET: splice fichero -> pipe -> socket enlazados.
+// Una conexión tiene como mucho una operación de entrada (recv o write de FILE) y una de
+// salida en curso; si se cierra con alguna pendiente se libera al volver la última CQE.
+#define URING_ENTRIES 4096
+#define URING_BUFS 256             // buffers provistos de BUFFER_SIZE por worker
+enum { UR_ACCEPT = 1, UR_MAILBOX, UR_ACCEPT_UNIX, UR_CANCEL };    // user_data de las operaciones del worker
+// Primero las de entrada (ur.in), después las de salida (ur.out)
+enum { UR_RECV = 1, UR_FRECV, UR_FWRITE, UR_RSPLICE, UR_RWAIT, UR_SEND, UR_GETIN, UR_GETOUT, UR_RELAYOUT };
+#define UR_OP_MASK 15              // user_data = client_ctx (alineado a 64) | operación
+#define UR_DATA(c, op) ((uint64_t)(uintptr_t)(c) | (uint64_t)(op))
+
+typedef struct {
+    struct msghdr mh;
+    struct iovec iov[IOV_BATCH];
+} ur_msg;
+_Static_assert(sizeof(ur_msg) <= IOBUF_SIZE, "ur_msg debe caber en un buffer de buf_pool");
+
+// El listener TCP del worker o, con --unix, el AF_UNIX compartido (cada worker con su accept)
+static void uring_listen(worker *w, bool un) {
+    struct io_uring_sqe *s = uring_sqe(&w->ur->ring);
+    if (!s) { fprintf(stderr, "worker %d: cola de io_uring llena, sin accept\n", w->id); return; }
+    uring_prep(s, IORING_OP_ACCEPT, un ? unix_fd : w->listen_fd, NULL, 0, 0, un ? UR_ACCEPT_UNIX : UR_ACCEPT);
+    s->ioprio = IORING_ACCEPT_MULTISHOT;
+    s->accept_flags = SOCK_CLOEXEC;
+}
+static void uring_watch_mailbox(worker *w) {
+    struct io_uring_sqe *s = uring_sqe(&w->ur->ring);
+    if (!s) { fprintf(stderr, "worker %d: cola de io_uring llena, sin buzón\n", w->id); return; }
+    uring_prep(s, IORING_OP_POLL_ADD, w->mb_fd, NULL, IORING_POLL_ADD_MULTI, 0, UR_MAILBOX);
+    s->poll32_events = POLLIN;
+}
+// Relevo: el accept multishot tiene su propia referencia al listener; cerrarlo no basta.
+static void uring_unlisten(worker *w) {
+    uring_cancel_sync(&w->ur->ring, UR_ACCEPT);
+    if (unix_fd >= 0) uring_cancel_sync(&w->ur->ring, UR_ACCEPT_UNIX);
+}
+
+// ctx_free() con operaciones en curso: que terminen cuanto antes (el recv vuelve con 0 al
+// cerrar la lectura) y liberarla con la última CQE. Lo que ya se estaba enviando (un
+// TIMEOUT, un FILE_ERR) tiene un segundo para salir; después ctx_timer_fire lo corta.
+static void uring_abort(client_ctx *c) {
+    twheel *tw = &c->shard->tw;
+    c->ur.dead = true;
+    if (c->hr.handoff) { tw_cancel(tw, &c->tmr); return; }     // el socket ya es del sucesor
+    shutdown(c->sock, c->evicted ? SHUT_RDWR : SHUT_RD);
+    // SENDTO: un splice que espera al pipe o el POLL_ADD sobre él no se enteran del shutdown().
+    // Los splice están en los hilos del kernel: cancelación asíncrona (ver uring_cancel_sync)
+    uring *u = &c->shard->ur->ring;
+    if (c->rl.src && c->ur.in) {
+        uring_cancel(u, UR_DATA(c, UR_RSPLICE), UR_CANCEL);
+        uring_cancel(u, UR_DATA(c, UR_RWAIT), UR_CANCEL);
+    }
+    if (c->rl.dst && c->ur.out) uring_cancel(u, UR_DATA(c, UR_RELAYOUT), UR_CANCEL);
+    tw_arm(tw, &c->tmr, loop_tick + TICKS(1));
+}
+
+// GET: fichero -> pipe -> socket con dos splice enlazados. Si el primero se queda corto (el
+// pipe es más pequeño) el segundo se cancela y lo que quedó en el pipe sale en la siguiente.
+static int uring_splice_get(client_ctx *c) {
+    uring *u = &c->shard->ur->ring;
+    if (c->pipefd[0] < 0) {
+        if (pipe2(c->pipefd, O_CLOEXEC) != 0) return -1;
+        fcntl(c->pipefd[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+    }
+    if (!uring_room(u, 2)) return -1;
+    struct io_uring_sqe *s;
+    unsigned len = (unsigned)c->ur.pipe;
+    if (c->ur.pipe == 0) {
+        len = c->get_left > SPLICE_CHUNK ? SPLICE_CHUNK : (unsigned)c->get_left;
+        s = uring_sqe(u);
+        uring_prep(s, IORING_OP_SPLICE, c->pipefd[1], NULL, len, (uint64_t)-1, UR_DATA(c, UR_GETIN));
+        s->splice_fd_in = c->get_fd;
+        s->splice_off_in = (uint64_t)c->get_off;
+        s->splice_flags = SPLICE_F_MOVE;
+        s->flags = IOSQE_IO_LINK;
+        c->ur.out++;
+    }
+    s = uring_sqe(u);
+    uring_prep(s, IORING_OP_SPLICE, c->sock, NULL, len, (uint64_t)-1, UR_DATA(c, UR_GETOUT));
+    s->splice_fd_in = c->pipefd[0];
+    s->splice_off_in = (uint64_t)-1;
+    s->splice_flags = SPLICE_F_MOVE;
+    c->ur.out++;
+    return 0;
+}
+// SENDTO: pipe -> socket del destinatario. Con el pipe vacío el splice espera en los hilos
+// del kernel a que el emisor lo llene; vuelve con lo que haya, aunque sea menos.
+static int uring_splice_relay(client_ctx *c) {
+    struct io_uring_sqe *s = uring_sqe(&c->shard->ur->ring);
+    if (!s) return -1;
+    unsigned len = c->get_left > SPLICE_CHUNK ? SPLICE_CHUNK : (unsigned)c->get_left;
+    uring_prep(s, IORING_OP_SPLICE, c->sock, NULL, len, (uint64_t)-1, UR_DATA(c, UR_RELAYOUT));
+    s->splice_fd_in = c->get_fd;
+    s->splice_off_in = (uint64_t)-1;
+    s->splice_flags = SPLICE_F_MOVE;
+    c->ur.out = 1;
+    return 0;
+}
+// SENDTO: el emisor ya lo metió todo en el pipe; POLL_ADD sin eventos, que vuelve con
+// POLLERR cuando el receptor cierra su extremo.
+static void uring_relay_wait(client_ctx *c) {
+    struct io_uring_sqe *s = uring_sqe(&c->shard->ur->ring);
+    if (!s) { c->state = ST_CLOSE; return; }
+    uring_prep(s, IORING_OP_POLL_ADD, c->rl.src->pipefd[1], NULL, 0, 0, UR_DATA(c, UR_RWAIT));
+    s->poll32_events = 0;
+    c->ur.in = 1;
+}
+// ctx_flush() en uring: pone en marcha el envío de la cola (o del GET en curso) si no hay
+// uno ya. -1 si no se pudo.
+static int uring_send(client_ctx *c) {
+    if (c->ur.out || c->ur.dead) return 0;
+    while (1) {
+        int lim = c->get_fd >= 0 ? c->get_before : IOV_BATCH;
+        if (c->oq_head && lim > 0) {
+            ur_msg *m = (ur_msg*)pool_get(&buf_pool, &buf_tc);
+            struct io_uring_sqe *s = m ? uring_sqe(&c->shard->ur->ring) : NULL;
+            if (!s) { if (m) pool_put(&buf_pool, &buf_tc, m); return -1; }
+            int n = 0;
+            for (oseg *o = c->oq_head; o && n < lim && n < IOV_BATCH; o = o->next, n++) {
+                m->iov[n].iov_base = o->b->data + o->off;
+                m->iov[n].iov_len = o->b->len - o->off;
+            }
+            memset(&m->mh, 0, sizeof(m->mh));
+            m->mh.msg_iov = m->iov;
+            m->mh.msg_iovlen = (size_t)n;
+            uring_prep(s, IORING_OP_SENDMSG, c->sock, &m->mh, 1, 0, UR_DATA(c, UR_SEND));
+            s->msg_flags = MSG_NOSIGNAL;
+            c->ur.msg = m;
+            c->ur.out = 1;
+            return 0;
+        }
+        if (c->get_fd < 0) return 0;
+        if (c->rl.dst && c->get_left > 0) return uring_splice_relay(c);
+        if (!c->rl.dst && (c->get_left > 0 || c->ur.pipe > 0)) return uring_splice_get(c);
+        if (!c->rl.dst) met_add(M_GETS, 1);
+        get_end(c);                    // y sigue con lo que llegó a la cola detrás
+    }
+}
+
+// Rearma la entrada si toca: nada en curso ni retenido y la sesión quiere leer.
+static void uring_recv(client_ctx *c) {
+    worker_ring *r = c->shard->ur;
+    if (c->ur.in || c->ur.bid >= 0 || c->ur.dead || c->state == ST_CLOSE || ctx_input_blocked(c)) return;
+    c->ur.starved = false;
+    struct io_uring_sqe *s;
+    if (zerocopy && c->state == ST_FILE && c->up.fd >= 0 && !c->up.wbuf && !c->up.zbuf && !c->up.crc_want &&
+        !c->up.sha_on && (!c->in.data || rbuf_len(&c->in) == 0)) {
+        if (!c->up.fbuf && !(c->up.fbuf = (char*)malloc(FILE_BUF))) { c->state = ST_CLOSE; return; }
+        if (!(s = uring_sqe(&r->ring))) goto starved;
+        unsigned want = c->up.left > FILE_BUF ? FILE_BUF : (unsigned)c->up.left;
+        uring_prep(s, IORING_OP_RECV, c->sock, c->up.fbuf, want, 0, UR_DATA(c, UR_FRECV));
+        c->ur.in = 1;
+        return;
+    }
+    if (c->state == ST_RELAY && c->rl.src && (!c->in.data || rbuf_len(&c->in) == 0)) {
+        // SENDTO: socket -> pipe; con el pipe lleno espera a que el receptor lo vacíe
+        if (!(s = uring_sqe(&r->ring))) goto starved;
+        unsigned want = c->rl.left > SPLICE_CHUNK ? SPLICE_CHUNK : (unsigned)c->rl.left;
+        uring_prep(s, IORING_OP_SPLICE, c->rl.src->pipefd[1], NULL, want, (uint64_t)-1, UR_DATA(c, UR_RSPLICE));
+        s->splice_fd_in = c->sock;
+        s->splice_off_in = (uint64_t)-1;
+        s->splice_flags = SPLICE_F_MOVE;
+        c->ur.in = 1;
+        return;
+    }
+    if (!(s = uring_sqe(&r->ring))) goto starved;
+    uring_prep(s, IORING_OP_RECV, c->sock, NULL, r->bufs.size, 0, UR_DATA(c, UR_RECV));
+    s->flags = IOSQE_BUFFER_SELECT;
+    s->buf_group = r->bufs.bgid;
+    c->ur.in = 1;
+    return;
+starved:
+    c->ur.starved = true;
+    r->starved = true;
+}
+// Buffers devueltos: se reintenta el recv de las que se quedaron sin ninguno.
+static void uring_unstarve(worker *w) {
+    w->ur->starved = false;
+    for (client_ctx *c = w->conns; c; c = c->w_next)
+        if (c->ur.starved) uring_recv(c);
+}
+
+// Lo que queda del buffer provisto retenido (ur.bid), a la sesión. Si la entrada se bloquea
+// (GET en curso, cola llena) el buffer sigue retenido hasta que se pueda seguir.
+static void uring_input(client_ctx *c) {
+    uring_bufs *b = &c->shard->ur->bufs;
+    while (c->ur.bid >= 0 && c->state != ST_CLOSE && !ctx_input_blocked(c)) {
+        const char *p = uring_buf(b, (unsigned)c->ur.bid) + c->ur.boff;
+        size_t used;
+        if (c->state == ST_FILE && (!c->in.data || rbuf_len(&c->in) == 0)) {
+            if (c->up.zbuf) used = receive_z(c, p, c->ur.blen);
+            else {
+                used = (long long)c->ur.blen > c->up.left ? (size_t)c->up.left : c->ur.blen;
+                receive_file(c, p, used);
+            }
+        } else {
+            if (!in_attach(c)) { c->state = ST_CLOSE; break; }
+            used = rbuf_put(&c->in, p, c->ur.blen);
+            if (used == 0) { c->state = ST_CLOSE; break; }       // como rbuf_fill() con ENOBUFS
+            session_consume(c);
+        }
+        c->ur.boff += (unsigned)used;
+        c->ur.blen -= (unsigned)used;
+        if (c->ur.blen == 0) { uring_buf_put(b, (unsigned)c->ur.bid); c->ur.bid = -1; }
+    }
+}
+
+// Tras cada completion de una conexión viva: retoma la entrada pendiente si ya se puede,
+// pone en marcha el envío de lo encolado, rearma el recv y la cierra si ya terminó.
+static void uring_pump(client_ctx *c) {
+    if (c->state != ST_CLOSE && !ctx_input_blocked(c) && c->in.data && rbuf_len(&c->in) > 0) session_consume(c);
+    uring_input(c);
+    if (uring_send(c) != 0) { ctx_free(c); return; }
+    uring_recv(c);
+    if (c->state == ST_CLOSE && (c->evicted || ctx_out_empty(c))) { ctx_free(c); return; }
+    ctx_timer_update(c);
+}
+
+// FILE por copia: vuelve el recv directo con lo que haya llegado, aunque sea poco (cuenta
+// como avance para el plazo), y se pide el write de esos bytes. false si se cerró.
+static void uring_file_done(client_ctx *c, int put);
+static bool uring_file_recv(client_ctx *c, int got) {
+    if (got <= 0) {
+        if (got == 0) session_eof(c);
+        else fprintf(stderr, "recv: %s\n", strerror(-got));
+        ctx_free(c);
+        return false;
+    }
+    ctx_bytes_in(c, got);
+    c->last_in = loop_tick;
+    c->ur.want = (unsigned)got;
+    struct io_uring_sqe *s = uring_sqe(&c->shard->ur->ring);
+    if (!s) { uring_file_done(c, 0); return true; }       // sin sitio en la cola: se escribe aquí
+    uring_prep(s, IORING_OP_WRITE, c->up.fd, c->up.fbuf, (unsigned)got, (uint64_t)c->up.off, UR_DATA(c, UR_FWRITE));
+    c->ur.in = 1;
+    return true;
+}
+// Vuelve el write de FILE; lo que no escribió (corto) se escribe aquí.
+static void uring_file_done(client_ctx *c, int put) {
+    size_t got = c->ur.want, done = put > 0 ? (size_t)put : 0;
+    if (done) file_wrote(c, done);
+    if (done < got) {
+        if (put < 0) file_fail(c);     // fallo al escribir: se sigue descartando
+        else file_pwrite(c, c->up.fbuf + done, got - done, c->up.off + (long long)done);
+    }
+    c->up.spliced += (long long)got;
+    c->up.off += (long long)got;
+    c->up.left -= (long long)got;
+    if (c->up.left == 0) finish_file(c);
+}
+
+static void uring_complete(worker *w, client_ctx *c, int op, int res, unsigned flags) {
+    worker_ring *r = w->ur;
+    bool input = op <= UR_RWAIT;
+    if (input) c->ur.in--; else c->ur.out--;
+    if (op == UR_SEND) { pool_put(&buf_pool, &buf_tc, c->ur.msg); c->ur.msg = NULL; }
+    if (c->ur.dead) {
+        if (op == UR_RECV && (flags & IORING_CQE_F_BUFFER)) uring_buf_put(&r->bufs, uring_buf_id(&r->bufs, flags));
+        if (!c->ur.in && !c->ur.out) ctx_release(c);
+        return;
+    }
+    switch (op) {
+    case UR_RECV:
+        if (res > 0) {
+            ctx_bytes_in(c, res);
+            c->last_in = loop_tick;
+            c->ur.bid = (int)uring_buf_id(&r->bufs, flags);
+            c->ur.boff = 0;
+            c->ur.blen = (unsigned)res;
+            break;
+        }
+        if (res == -ENOBUFS) {         // se reintenta cuando se devuelva algún buffer
+            c->ur.starved = true;
+            r->starved = true;
+            ctx_timer_update(c);
+            return;
+        }
+        if (res == -ECANCELED) break;  // relevo que no llegó a hacerse: se rearma
+        if (res == 0) session_eof(c);
+        else fprintf(stderr, "recv: %s\n", strerror(-res));
+        ctx_free(c);
+        return;
+    case UR_FRECV:
+        if (!uring_file_recv(c, res)) return;
+        break;
+    case UR_FWRITE:
+        uring_file_done(c, res);
+        break;
+    case UR_RSPLICE:                   // SENDTO: socket del emisor -> pipe
+        if (res > 0) {
+            ctx_bytes_in(c, res);
+            c->last_in = loop_tick;
+            relay_src_moved(c, res);
+            break;
+        }
+        if (res == -EPIPE) { relay_src_fail(c); break; }    // sin receptor: el resto se descarta
+        if (res == 0) session_eof(c);
+        else fprintf(stderr, "splice: %s\n", strerror(-res));
+        ctx_free(c);
+        return;
+    case UR_RWAIT:                     // SENDTO: el receptor cerró su extremo
+        if (c->rl.src && !relay_src_done(c)) uring_relay_wait(c);
+        break;
+    case UR_SEND:
+        if (res < 0) { ctx_free(c); return; }
+        ctx_bytes_out(c, res);
+        c->last_out = loop_tick;
+        ctx_advance(c, (size_t)res);
+        break;
+    case UR_GETIN:                     // fichero -> pipe; 0: el archivo encogió
+        if (res <= 0) { ctx_free(c); return; }
+        c->get_off += res;
+        c->get_left -= res;
+        c->ur.pipe += res;
+        break;
+    case UR_GETOUT:                    // pipe -> socket; cancelado si el anterior se quedó corto
+        if (res == -ECANCELED) break;
+        if (res <= 0) { ctx_free(c); return; }
+        c->ur.pipe -= res;
+        ctx_bytes_out(c, res);
+        met_add(M_GET_BYTES, res);
+        c->last_out = loop_tick;
+        break;
+    case UR_RELAYOUT:                  // SENDTO: pipe -> socket; 0: el emisor se fue antes de acabar
+        if (res <= 0) { ctx_free(c); return; }
+        c->get_left -= res;
+        ctx_bytes_out(c, res);
+        met_add(M_RELAY_BYTES, res);
+        relay_dst_tick(c);
+        c->last_out = loop_tick;
+        break;
+    }
+    if (!input && c->ur.out) return;   // GET: falta la otra mitad
+    uring_pump(c);
+}
+
+static void uring_accept(worker *w, bool un, int res, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE) && !w->drained) uring_listen(w, un);
+    if (res < 0) {
+        if (res != -ECANCELED && res != -ECONNABORTED && res != -EINTR) fprintf(stderr, "accept: %s\n", strerror(-res));
+        return;
+    }
+    // Con multishot no hay dirección por conexión: ctx_new() la pide al socket
+    client_ctx *c = ctx_new(res, un ? AF_UNIX : AF_INET, NULL, true);
+    if (!c) { close(res); return; }
+    c->shard = w;
+    conn_link(w, c);
+    atomic_fetch_add_explicit(&w->accepted, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&w->active, 1, memory_order_relaxed);
+    uring_recv(c);
+    ctx_timer_update(c);
+}
+
+// Relevo: cancela el recv en reposo para poder entregar la conexión. false si no estaba en
+// reposo (su recv ya volvió con datos, aún sin procesar, o hay un envío en curso).
+static bool uring_detach(client_ctx *c) {
+    if (c->ur.out || c->ur.bid >= 0) return false;
+    if (c->ur.in && uring_cancel_sync(&c->shard->ur->ring, UR_DATA(c, UR_RECV)) != 0) return false;
+    c->hr.handoff = true;
+    return true;
+}
+
+static void *uring_loop(void *arg) {
+    worker *w = (worker*)arg;
+    worker_pin(w);
+    worker_ring *r = (worker_ring*)calloc(1, sizeof(worker_ring));
+    if (!r) { perror("calloc"); exit(EXIT_FAILURE); }
+    // Un solo hilo usa el anillo y el trabajo diferido del kernel se hace al esperar
+    int e = uring_init(&r->ring, URING_ENTRIES, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+    if (e == 0) e = uring_bufs_init(&r->ring, &r->bufs, 0, URING_BUFS, BUFFER_SIZE);
+    if (e < 0) { fprintf(stderr, "worker %d: io_uring: %s\n", w->id, strerror(-e)); exit(EXIT_FAILURE); }
+    w->ur = r;
+    uring_listen(w, false);
+    if (unix_fd >= 0) uring_listen(w, true);
+    uring_watch_mailbox(w);
+
+    loop_tick = tick_now();
+    tw_init(&w->tw, loop_tick);
+    while (1) {
+        // Envía todo lo pedido en la vuelta anterior y espera; con temporizadores armados,
+        // como mucho un tick
+        int rc = uring_wait(&r->ring, w->tw.armed ? (int)(TICK_NS / 1000000) : -1);
+        loop_tick = tick_now();
+        if (rc < 0 && rc != -EINTR && rc != -ETIME && rc != -EBUSY && rc != -EAGAIN) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(-rc));
+            break;
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_cqe(&r->ring))) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned fl = cqe->flags;
+            uring_cqe_seen(&r->ring);
+            if (data == UR_CANCEL) continue;       // la cancelada vuelve con su propia CQE
+            if (data == UR_ACCEPT || data == UR_ACCEPT_UNIX) uring_accept(w, data == UR_ACCEPT_UNIX, res, fl);
+            else if (data == UR_MAILBOX) {
+                if (!(fl & IORING_CQE_F_MORE)) uring_watch_mailbox(w);
+                mailbox_drain(w);
+            } else {
+                client_ctx *c = (client_ctx*)(uintptr_t)(data & ~(uint64_t)UR_OP_MASK);
+                uring_complete(w, c, (int)(data & UR_OP_MASK), res, fl);
+            }
+        }
+        if (r->starved && r->bufs.out < r->bufs.count) uring_unstarve(w);
+        relay_reap(w);
+        tw_advance(&w->tw, loop_tick, ctx_timer_fire, w);
+        atomic_store_explicit(&w->timers, w->tw.armed, memory_order_relaxed);
+        atomic_store_explicit(&w->ur_enters, r->ring.enters, memory_order_relaxed);
+        atomic_store_explicit(&w->ur_cqes, r->ring.completions, memory_order_relaxed);
+        if (atomic_load_explicit(&draining, memory_order_acquire) && hr_drain(w)) break;
+    }
+    return NULL;
+}
+
+// SIGUSR1 imprime el reparto de carga entre shards
+static void print_shard_stats(void) {
+    unsigned long total = 0;
+    for (int i = 0; i < nworkers; i++) total += atomic_load_explicit(&workers[i].accepted, memory_order_relaxed);
+    alog("[SHARDS] %d workers, %lu conexiones aceptadas, %llu registros de log descartados\n",
+         nworkers, total, alog_dropped());
+    for (int i = 0; i < nworkers; i++) {
+        worker *w = &workers[i];
+        unsigned long acc = atomic_load_explicit(&w->accepted, memory_order_relaxed);
+        alog("  shard %d (cpu %d): aceptadas %lu (%.1f%%), activas %lu, temporizadores %lu, entrada %llu B, salida %llu B\n",
+               w->id, w->cpu, acc, total ? 100.0 * (double)acc / (double)total : 0.0,
+               atomic_load_explicit(&w->active, memory_order_relaxed),
+               atomic_load_explicit(&w->timers, memory_order_relaxed),
+               atomic_load_explicit(&w->bytes_in, memory_order_relaxed),
+               atomic_load_explicit(&w->bytes_out, memory_order_relaxed));
+        unsigned long long ue = atomic_load_explicit(&w->ur_enters, memory_order_relaxed);
+        unsigned long long uc = atomic_load_explicit(&w->ur_cqes, memory_order_relaxed);
+        if (ue) alog("    io_uring: %llu llamadas a io_uring_enter(), %llu completions (%.1f por llamada)\n",
+                     ue, uc, (double)uc / (double)ue);
+    }
+    char pf[256];
+    if (pool_format(pf, sizeof(pf), "  ") > 0) alog("%s", pf);
+}
+// SIGUSR1: reparto entre shards; SIGUSR2: reinicio en caliente
+static void *shard_stats_thread(void *arg) {
+    sigset_t *set = (sigset_t*)arg;
+    int sig;
+    while (sigwait(set, &sig) == 0) {
+        if (sig == SIGUSR2) hr_start();
+        else print_shard_stats();
+    }
+    return NULL;
+}
+
+static int create_listener(int backlog, bool reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("SO_REUSEPORT"); close(fd); return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(PORT);
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind"); close(fd); return -1;
+    }
+    if (listen(fd, backlog) < 0) {
+        perror("listen"); close(fd); return -1;
+    }
+    return fd;
+}
+// --unix: mismo protocolo por un socket AF_UNIX. Si en la ruta quedó el socket de una
+// ejecución anterior se borra (cualquier otro fichero se deja y falla el bind()).
+static int create_unix_listener(const char *path, int backlog) {
+    struct sockaddr_un a;
+    memset(&a, 0, sizeof(a));
+    a.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(a.sun_path)) { fprintf(stderr, "--unix: ruta demasiado larga: %s\n", path); return -1; }
+    memcpy(a.sun_path, path, strlen(path));
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    if (bind(fd, (struct sockaddr*)&a, sizeof(a)) < 0) { perror(path); close(fd); return -1; }
+    if (listen(fd, backlog) < 0) { perror("listen"); close(fd); return -1; }
+    return fd;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Uso: %s [-m fork|epoll|uring] [-w N] [-b N] [--pin] [--no-zerocopy] [--log-policy drop|block]\n"
+        "          [--stats-file RUTA] [--stats-interval SEG] [--dedup]\n"
+        "          [--out-high N] [--out-low N] [--out-max N] [--slow-grace SEG] [--slow-policy close|drop]\n"
+        "          [--auth-timeout SEG] [--idle-timeout SEG] [--xfer-timeout SEG] [--handover-conns]\n"
+        "          [--store-mode plain|coalesce|direct] [--store-buf N] [--no-prealloc] [--fsync none|end|N]\n"
+        "          [--max-sessions N] [--unix RUTA]\n"
+        "  -m, --mode       modelo de concurrencia: fork (por defecto), epoll o uring (io_uring;\n"
+        "                   kernel 6.0 o posterior)\n"
+        "  -w, --workers    epoll/uring: N workers con listener SO_REUSEPORT propio (0 = uno por CPU; por defecto 1)\n"
+        "  -b, --backlog    backlog de listen() (por defecto 16)\n"
+        "  --pin            epoll/uring: fijar cada worker a una CPU\n"
+        "  --no-zerocopy    recibir FILE copiando por buffer en vez de splice()\n"
+        "  --log-policy     con el log asíncrono lleno: descartar y contar (drop, por defecto) o esperar (block)\n"
+        "  --stats-file     volcar métricas (contadores y p50/p99) a RUTA periódicamente\n"
+        "  --stats-interval segundos entre volcados (por defecto 10)\n"
+        "  --dedup          almacén por contenido en uploads/.store (SHA-256) y comando HAVE\n"
+        "  --out-high       bytes en la cola de salida a partir de los que se deja de leer la conexión\n"
+        "                   (admite K/M; por defecto 256K)\n"
+        "  --out-low        se vuelve a leer al bajar de aquí (por defecto out-high / 4)\n"
+        "  --out-max        epoll/uring: desconectar al pasar de aquí (por defecto 4 * out-high)\n"
+        "  --slow-grace     segundos por encima de out-high antes de desconectar; en fork, tiempo\n"
+        "                   máximo de un send() bloqueado (por defecto 10)\n"
+        "  --slow-policy    con la cola por encima de out-high: close (desconectar según lo anterior,\n"
+        "                   por defecto) o drop (descartar los mensajes de sala para esa conexión)\n"
+        "  --auth-timeout   segundos desde la conexión para completar AUTH (por defecto 10; 0 = sin plazo)\n"
+        "  --idle-timeout   segundos sin recibir nada en el chat (por defecto 300; 0 = sin plazo)\n"
+        "  --xfer-timeout   segundos sin avanzar un FILE/CHUNK o un GET (por defecto 30; 0 = sin plazo)\n"
+        "  --handover-conns epoll/uring: en un reinicio en caliente (kill -USR2) pasar también al sucesor\n"
+        "                   las sesiones de chat sin nada pendiente (las demás acaban en este proceso)\n"
+        "  --store-mode     escritura de subidas: plain (cada trozo según llega, con splice() si se\n"
+        "                   puede; por defecto), coalesce (en bloques alineados de --store-buf) o\n"
+        "                   direct (como coalesce, con O_DIRECT)\n"
+        "  --store-buf      tamaño de esos bloques (múltiplo de 4K; por defecto 1M)\n"
+        "  --no-prealloc    no reservar con fallocate() el espacio de un FILE según llega\n"
+        "  --fsync          none (por defecto), end (fdatasync antes de FILE_OK) o N (cada N MB y al final)\n"
+        "  --max-sessions   huecos del directorio de sesiones que consulta WHO (por defecto 4096); las\n"
+        "                   sesiones de más funcionan igual pero no aparecen\n"
+        "  --unix           escuchar también en un socket AF_UNIX en RUTA (mismo protocolo), para\n"
+        "                   clientes en la misma máquina\n", prog);
+}
+static long long parse_size(const char *s) {
+    char *end; double v = strtod(s, &end);
+    switch (toupper((unsigned char)*end)) {
+    case 'K': v *= 1024; break;
+    case 'M': v *= 1024 * 1024; break;
+    case 'G': v *= 1024.0 * 1024 * 1024; break;
+    }
+    return (long long)v;
+}
+
+int main(int argc, char **argv) {
+    bool use_epoll = false, use_uring = false, pin_cpus = false;
+    int backlog = 16, log_policy = ALOG_DROP;
+    static const struct option opts[] = {
+        { "mode", required_argument, NULL, 'm' },
+        { "workers", required_argument, NULL, 'w' },
+        { "backlog", required_argument, NULL, 'b' },
+        { "pin", no_argument, NULL, 'P' },
+        { "no-zerocopy", no_argument, NULL, 'Z' },
+        { "log-policy", required_argument, NULL, 'L' },
+        { "stats-file", required_argument, NULL, 'S' },
+        { "stats-interval", required_argument, NULL, 'I' },
+        { "dedup", no_argument, NULL, 'D' },
+        { "out-high", required_argument, NULL, 'Q' },
+        { "out-low", required_argument, NULL, 'q' },
+        { "out-max", required_argument, NULL, 'X' },
+        { "slow-grace", required_argument, NULL, 'G' },
+        { "slow-policy", required_argument, NULL, 'Y' },
+        { "auth-timeout", required_argument, NULL, 'A' },
+        { "idle-timeout", required_argument, NULL, 'T' },
+        { "xfer-timeout", required_argument, NULL, 'x' },
+        { "handover-conns", no_argument, NULL, 'H' },
+        { "takeover", required_argument, NULL, 'K' },    // interno: lo pone hr_spawn()
+        { "store-mode", required_argument, NULL, 'W' },
+        { "store-buf", required_argument, NULL, 'U' },
+        { "no-prealloc", no_argument, NULL, 'N' },
+        { "fsync", required_argument, NULL, 'F' },
+        { "max-sessions", required_argument, NULL, 'M' },
+        { "unix", required_argument, NULL, 'u' },
+        { "help", no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int o;
+    while ((o = getopt_long(argc, argv, "m:w:b:h", opts, NULL)) != -1) {
+        switch (o) {
+        case 'm':
+            if (strcmp(optarg, "fork") == 0) use_epoll = use_uring = false;
+            else if (strcmp(optarg, "epoll") == 0) { use_epoll = true; use_uring = false; }
+            else if (strcmp(optarg, "uring") == 0) use_epoll = use_uring = true;
+            else { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            if (backlog <= 0) { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'P':
+            pin_cpus = true;
+            break;
+        case 'Z':
+            zerocopy = false;
+            break;
+        case 'L':
+            if (strcmp(optarg, "drop") == 0) log_policy = ALOG_DROP;
+            else if (strcmp(optarg, "block") == 0) log_policy = ALOG_BLOCK;
+            else { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'S':
+            stats_path = optarg;
+            break;
+        case 'I':
+            stats_interval = atoi(optarg);
+            if (stats_interval <= 0) { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'D':
+            dedup = true;
+            break;
+        case 'Q': case 'q': case 'X': {
+            long long v = parse_size(optarg);
+            if (v <= 0) { usage(argv[0]); return EXIT_FAILURE; }
+            *(o == 'Q' ? &out_high : o == 'q' ? &out_low : &out_max) = (size_t)v;
+            break;
+        }
+        case 'G':
+            slow_grace = atoi(optarg);
+            if (slow_grace <= 0) { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'Y':
+            if (strcmp(optarg, "close") == 0) slow_policy = SLOW_CLOSE;
+            else if (strcmp(optarg, "drop") == 0) slow_policy = SLOW_DROP;
+            else { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'A': case 'T': case 'x': {
+            int v = atoi(optarg);
+            if (v < 0) { usage(argv[0]); return EXIT_FAILURE; }
+            *(o == 'A' ? &auth_timeout : o == 'T' ? &idle_timeout : &xfer_timeout) = v;
+            break;
+        }
+        case 'H':
+            handover_conns = true;
+            break;
+        case 'K':
+            takeover_fd = atoi(optarg);
+            break;
+        case 'W':
+            if (strcmp(optarg, "plain") == 0) store_mode = STORE_PLAIN;
+            else if (strcmp(optarg, "coalesce") == 0) store_mode = STORE_COALESCE;
+            else if (strcmp(optarg, "direct") == 0) store_mode = STORE_DIRECT;
+            else { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'U': {
+            long long v = parse_size(optarg);
+            if (v < 64 * 1024) { usage(argv[0]); return EXIT_FAILURE; }
+            store_buf = (size_t)v & ~(size_t)(DIRECT_ALIGN - 1);
+            break;
+        }
+        case 'N':
+            prealloc = false;
+            break;
+        case 'F':
+            if (strcmp(optarg, "none") == 0) fsync_every = 0;
+            else if (strcmp(optarg, "end") == 0) fsync_every = -1;
+            else if ((fsync_every = atoll(optarg) * 1024 * 1024) <= 0) { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'M': {
+            long v = atol(optarg);
+            if (v <= 0 || v > (1 << 24)) { usage(argv[0]); return EXIT_FAILURE; }
+            max_sessions = (unsigned)v;
+            break;
+        }
+        case 'u': unix_path = optarg; break;
+        default:
+            usage(argv[0]); return (o == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!out_low) out_low = out_high / 4;
+    if (!out_max) out_max = out_high * 4;
+    if (out_low > out_high || out_max < out_high) { usage(argv[0]); return EXIT_FAILURE; }
+    if (use_uring) {
+        // Sin io_uring (kernel antiguo, o prohibido por seccomp en un contenedor) mejor saberlo al arrancar
+        uring probe;
+        int e = uring_init(&probe, 8, 0);
+        bool ext = e == 0 && (probe.features & IORING_FEAT_EXT_ARG);
+        if (e == 0) uring_exit(&probe);
+        if (!ext) {
+            fprintf(stderr, "io_uring no disponible (%s): use -m epoll\n", e < 0 ? strerror(-e) : "kernel demasiado antiguo");
+            return EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    // Para el reinicio en caliente: el binario que haya en disco con estos mismos argumentos
+    self_argv = argv;
+    if (!realpath(argv[0], self_exe)) snprintf(self_exe, sizeof(self_exe), "/proc/self/exe");
+    int inherited[HR_MAXFDS], ninherited = 0, inherited_unix = -1;
+    if (takeover_fd >= 0 && (ninherited = hr_inherit(inherited, &inherited_unix)) < 0) exit(EXIT_FAILURE);
+    if (unix_path) {
+        unix_fd = inherited_unix >= 0 ? inherited_unix : create_unix_listener(unix_path, backlog);
+        if (unix_fd < 0) exit(EXIT_FAILURE);
+    } else if (inherited_unix >= 0) close(inherited_unix);
+
+    // SIGUSR1/SIGUSR2 se bloquean antes de crear hilos para que solo los recoja shard_stats_thread
+    static sigset_t usr1;
+    sigemptyset(&usr1); sigaddset(&usr1, SIGUSR1); sigaddset(&usr1, SIGUSR2);
+    if (use_epoll) pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+    else {
+        // Sin SA_RESTART: accept() vuelve con EINTR y fork_loop atiende el relevo
+        struct sigaction sa = { .sa_handler = on_sigusr2 };
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR2, &sa, NULL);
+    }
+
+    if (metrics_init() != 0) exit(EXIT_FAILURE);
+    // Antes de cualquier fork(): los hijos heredan el mismo mapeo compartido
+    if (sd_init(&sessions, max_sessions) != 0) { perror("mmap directorio de sesiones"); exit(EXIT_FAILURE); }
+    if (stats_path) {
+        pthread_t dt;
+        if (pthread_create(&dt, NULL, stats_dump_thread, NULL) == 0) pthread_detach(dt);
+    }
+
+    if (!use_epoll) {
+        int server_fd = ninherited ? inherited[0] : create_listener(backlog, false);
+        if (server_fd < 0) exit(EXIT_FAILURE);
+        for (int i = 1; i < ninherited; i++) close(inherited[i]);
+        printf("Servidor esperando conexiones en el puerto %d (modo fork)...\n", PORT);
+        if (unix_path) printf("Y en el socket AF_UNIX %s\n", unix_path);
+        printf("Usuarios CSV: %s (formato: usuario,contraseña)\n", CSV_PATH);
+        fflush(stdout);
+        alog_start(STDOUT_FILENO, log_policy);
+        cred_init();
+        if (takeover_fd >= 0) {
+            hr_ready();
+            close(takeover_fd);
+            alog("[RELEVO] listener heredado del proceso anterior\n");
+        }
+        fork_loop(server_fd);
+        close(server_fd);
+        return 0;
+    }
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+    if (nworkers <= 0) nworkers = (int)ncpu;
+    if (ninherited) nworkers = ninherited;         // tantos workers como listeners heredados
+    workers = (worker*)calloc((size_t)nworkers, sizeof(worker));
+    if (!workers) { perror("calloc"); exit(EXIT_FAILURE); }
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        workers[i].cpu = pin_cpus ? (int)(i % ncpu) : -1;
+        workers[i].listen_fd = ninherited ? inherited[i] : create_listener(backlog, nworkers > 1);
+        if (workers[i].listen_fd < 0) exit(EXIT_FAILURE);
+        pthread_mutex_init(&workers[i].mb_mu, NULL);
+        workers[i].mb_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        workers[i].stage_head = (oseg**)calloc((size_t)nworkers, sizeof(oseg*));
+        workers[i].stage_tail = (oseg**)calloc((size_t)nworkers, sizeof(oseg*));
+        if (workers[i].mb_fd < 0 || !workers[i].stage_head || !workers[i].stage_tail) { perror("eventfd"); exit(EXIT_FAILURE); }
+    }
+
+    printf("Servidor esperando conexiones en el puerto %d (modo %s, %d worker%s, backlog %d)...\n",
+           PORT, use_uring ? "uring" : "epoll", nworkers, nworkers > 1 ? "s SO_REUSEPORT" : "", backlog);
+    if (unix_path) printf("Y en el socket AF_UNIX %s\n", unix_path);
+    printf("Usuarios CSV: %s (formato: usuario,contraseña)\n", CSV_PATH);
+    if (nworkers > 1) printf("kill -USR1 %d muestra el reparto por shard\n", (int)getpid());
+    fflush(stdout);
+    alog_start(STDOUT_FILENO, log_policy);
+    cred_init();
+
+    pthread_t st;
+    if (pthread_create(&st, NULL, shard_stats_thread, &usr1) == 0) pthread_detach(st);
+    void *(*loop)(void *) = use_uring ? uring_loop : epoll_loop;
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&workers[i].th, NULL, loop, &workers[i]) != 0) {
+            perror("pthread_create"); exit(EXIT_FAILURE);
+        }
+    }
+    if (takeover_fd >= 0) {
+        // Los workers ya están arrancando (y lo que llegue espera en la cola del listener)
+        hr_ready();
+        alog("[RELEVO] %d listener%s heredado%s del proceso anterior\n", nworkers,
+             nworkers > 1 ? "s" : "", nworkers > 1 ? "s" : "");
+        pthread_t at;
+        if (pthread_create(&at, NULL, hr_adopt_thread, NULL) == 0) pthread_detach(at);
+    }
+    loop(&workers[0]);
+    if (atomic_load(&hr_exit))                     // relevo terminado: los demás workers también salen
+        for (int i = 1; i < nworkers; i++) pthread_join(workers[i].th, NULL);
     return 0;
 }
@@ -0,0 +1,147 @@
+// sessdir.h
+// Directorio de sesiones en memoria compartida: tabla de tamaño fijo en un mmap() MAP_SHARED
+// creado antes de los fork(), así cada hijo (o worker) publica su sesión y cualquiera puede
+// leer la tabla entera sin preguntar a nadie (ni pipes ni ficheros).
+// - Reservar un hueco: compare-and-swap LIBRE -> OCUPADO empezando cada vez en una posición
+//   distinta (contador atómico compartido); sin cerrojos. Liberar es un store.
+// - Los datos fijos (usuario, dirección, hora de entrada) se escriben antes de publicar el
+//   hueco como VIVO; el lector copia y vuelve a mirar estado y generación para descartar
+//   un hueco que se liberó o se reutilizó mientras lo copiaba.
+// - Contadores de tráfico atómicos: solo los suma el dueño, los lee cualquiera. Cada hueco
+//   ocupa sus propias líneas de caché.
+// - Un proceso que muere sin liberar deja su hueco ocupado: sd_reap() recupera los de procesos
+//   que ya no existen. Lo hace sd_claim() con la tabla llena; quien lee la tabla entera para
+//   mostrarla debe llamarlo antes (si no, esas sesiones aparecen hasta que se llene).
+// - Uso: sd_init(&d, n); sd_slot *s = sd_claim(&d, usuario, dirección, time(NULL));
+//        atomic_fetch_add(&s->msgs, 1) ...; sd_read(&d, i, &e) para i < d.n; sd_release(&d, s);
+
+#ifndef SESSDIR_H
+#define SESSDIR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define SD_USER 64
+#define SD_ADDR 48
+
+enum { SD_FREE, SD_BUSY, SD_LIVE };
+
+typedef struct {
+    _Alignas(64) atomic_uint state;
+    atomic_uint gen;               // cambia en cada reserva
+    int pid;                       // proceso dueño
+    int64_t login;                 // time() de la entrada
+    char user[SD_USER];
+    char addr[SD_ADDR];
+    atomic_ullong bytes_in, bytes_out, msgs;
+} sd_slot;
+
+typedef struct {
+    _Alignas(64) atomic_uint next;  // dónde empieza a buscar la siguiente reserva
+    atomic_uint live;
+} sd_head;
+
+typedef struct {
+    sd_head *head;
+    sd_slot *slots;
+    unsigned n;
+} sessdir;
+
+// Copia de un hueco vivo para quien lee la tabla
+typedef struct {
+    int pid;
+    int64_t login;
+    char user[SD_USER];
+    char addr[SD_ADDR];
+    unsigned long long bytes_in, bytes_out, msgs;
+} sd_entry;
+
+static inline int sd_init(sessdir *d, unsigned n) {
+    size_t sz = sizeof(sd_head) + sizeof(sd_slot) * (size_t)n;
+    void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return -1;
+    d->head = (sd_head*)p;         // las páginas anónimas llegan a cero: todo SD_FREE
+    d->slots = (sd_slot*)((char*)p + sizeof(sd_head));
+    d->n = n;
+    return 0;
+}
+
+// Libera los huecos de procesos que ya no existen. Devuelve cuántos.
+static inline unsigned sd_reap(sessdir *d) {
+    unsigned freed = 0;
+    for (unsigned i = 0; i < d->n; i++) {
+        sd_slot *s = &d->slots[i];
+        unsigned st = SD_LIVE;
+        if (atomic_load_explicit(&s->state, memory_order_acquire) != SD_LIVE) continue;
+        if (s->pid == getpid() || kill(s->pid, 0) == 0 || errno != ESRCH) continue;
+        if (atomic_compare_exchange_strong(&s->state, &st, SD_FREE)) {
+            atomic_fetch_sub_explicit(&d->head->live, 1, memory_order_relaxed);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+// NULL con la tabla llena (la sesión sigue, solo que no aparece en el directorio).
+static inline sd_slot *sd_claim(sessdir *d, const char *user, const char *addr, int64_t login) {
+    if (!d->n) return NULL;
+    for (int pass = 0; pass < 2; pass++) {
+        unsigned start = atomic_fetch_add_explicit(&d->head->next, 1, memory_order_relaxed);
+        for (unsigned k = 0; k < d->n; k++) {
+            sd_slot *s = &d->slots[(start + k) % d->n];
+            unsigned st = SD_FREE;
+            if (atomic_load_explicit(&s->state, memory_order_relaxed) != SD_FREE ||
+                !atomic_compare_exchange_strong_explicit(&s->state, &st, SD_BUSY,
+                                                         memory_order_acquire, memory_order_relaxed)) continue;
+            atomic_fetch_add_explicit(&s->gen, 1, memory_order_relaxed);
+            s->pid = getpid();
+            s->login = login;
+            snprintf(s->user, sizeof(s->user), "%.*s", (int)sizeof(s->user) - 1, user);
+            snprintf(s->addr, sizeof(s->addr), "%.*s", (int)sizeof(s->addr) - 1, addr);
+            atomic_store_explicit(&s->bytes_in, 0, memory_order_relaxed);
+            atomic_store_explicit(&s->bytes_out, 0, memory_order_relaxed);
+            atomic_store_explicit(&s->msgs, 0, memory_order_relaxed);
+            atomic_fetch_add_explicit(&d->head->live, 1, memory_order_relaxed);
+            atomic_store_explicit(&s->state, SD_LIVE, memory_order_release);
+            return s;
+        }
+        if (pass == 0 && !sd_reap(d)) break;
+    }
+    return NULL;
+}
+
+static inline void sd_release(sessdir *d, sd_slot *s) {
+    atomic_fetch_sub_explicit(&d->head->live, 1, memory_order_relaxed);
+    atomic_store_explicit(&s->state, SD_FREE, memory_order_release);
+}
+
+// Copia el hueco i si está vivo y no cambió mientras se copiaba.
+static inline bool sd_read(const sessdir *d, unsigned i, sd_entry *e) {
+    sd_slot *s = &d->slots[i];
+    if (atomic_load_explicit(&s->state, memory_order_acquire) != SD_LIVE) return false;
+    unsigned gen = atomic_load_explicit(&s->gen, memory_order_relaxed);
+    e->pid = s->pid;
+    e->login = s->login;
+    memcpy(e->user, s->user, sizeof(e->user));
+    memcpy(e->addr, s->addr, sizeof(e->addr));
+    e->user[SD_USER - 1] = e->addr[SD_ADDR - 1] = '\0';
+    e->bytes_in = atomic_load_explicit(&s->bytes_in, memory_order_relaxed);
+    e->bytes_out = atomic_load_explicit(&s->bytes_out, memory_order_relaxed);
+    e->msgs = atomic_load_explicit(&s->msgs, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s->state, memory_order_relaxed) == SD_LIVE &&
+           atomic_load_explicit(&s->gen, memory_order_relaxed) == gen;
+}
+
+static inline unsigned sd_live(const sessdir *d) {
+    return atomic_load_explicit(&d->head->live, memory_order_relaxed);
+}
+
+#endif
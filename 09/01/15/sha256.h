@@ -0,0 +1,165 @@
+// sha256.h
+// SHA-256 incremental para el almacén deduplicado (el hash es el nombre del blob, así que
+// tiene que resistir colisiones: CRC32C no vale).
+// - En x86-64 con extensiones SHA (SHA-NI) usa sha256rnds2/sha256msg1/sha256msg2;
+//   si no, la implementación en C de FIPS 180-4. Se elige una vez, en la primera llamada.
+// - Uso: sha256_init(&s); sha256_update(&s, buf, n); ...; sha256_final(&s, out32).
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;                  // bytes procesados
+    unsigned char buf[64];
+    size_t n;                      // bytes pendientes en buf
+} sha256_ctx;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void (*sha256_blocks_impl)(uint32_t *, const unsigned char *, size_t);
+static pthread_once_t sha256_once = PTHREAD_ONCE_INIT;
+
+#define SHA256_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline void sha256_blocks_sw(uint32_t *st, const unsigned char *p, size_t nblocks) {
+    while (nblocks--) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = ((uint32_t)p[4*i] << 24) | ((uint32_t)p[4*i+1] << 16) | ((uint32_t)p[4*i+2] << 8) | p[4*i+3];
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = SHA256_ROR(w[i-15], 7) ^ SHA256_ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+            uint32_t s1 = SHA256_ROR(w[i-2], 17) ^ SHA256_ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+        uint32_t a = st[0], b = st[1], c = st[2], d = st[3], e = st[4], f = st[5], g = st[6], h = st[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (SHA256_ROR(e, 6) ^ SHA256_ROR(e, 11) ^ SHA256_ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+            uint32_t t2 = (SHA256_ROR(a, 2) ^ SHA256_ROR(a, 13) ^ SHA256_ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        st[0] += a; st[1] += b; st[2] += c; st[3] += d; st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+        p += 64;
+    }
+}
+
+#if defined(__x86_64__)
+// El estado va en dos registros como ABEF / CDGH, que es lo que esperan las instrucciones.
+__attribute__((target("sha,sse4.1,ssse3")))
+static inline void sha256_blocks_ni(uint32_t *st, const unsigned char *p, size_t nblocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&st[0]), 0xB1);   // CDAB
+    __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&st[4]), 0x1B);    // EFGH
+    __m128i s0 = _mm_alignr_epi8(tmp, s1, 8);                                          // ABEF
+    s1 = _mm_blend_epi16(s1, tmp, 0xF0);                                               // CDGH
+    while (nblocks--) {
+        __m128i abef = s0, cdgh = s1, w[4];
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16 * i)), bswap);
+            } else {
+                // W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16], cuatro a la vez
+                __m128i m = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                m = _mm_add_epi32(m, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(m, w[(i + 3) & 3]);
+            }
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i*)&sha256_k[4 * i]));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        s0 = _mm_add_epi32(s0, abef);
+        s1 = _mm_add_epi32(s1, cdgh);
+        p += 64;
+    }
+    tmp = _mm_shuffle_epi32(s0, 0x1B);                                                 // FEBA
+    s1 = _mm_shuffle_epi32(s1, 0xB1);                                                  // DCHG
+    _mm_storeu_si128((__m128i*)&st[0], _mm_blend_epi16(tmp, s1, 0xF0));                // DCBA
+    _mm_storeu_si128((__m128i*)&st[4], _mm_alignr_epi8(s1, tmp, 8));                   // HGFE
+}
+#endif
+
+static inline void sha256_pick(void) {
+    sha256_blocks_impl = sha256_blocks_sw;
+#if defined(__x86_64__)
+    unsigned a, b, c, d;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29)) && __builtin_cpu_supports("sse4.1"))
+        sha256_blocks_impl = sha256_blocks_ni;
+#endif
+}
+
+// "sha-ni" o "software", para los informes
+static inline const char *sha256_backend(void) {
+    pthread_once(&sha256_once, sha256_pick);
+    return sha256_blocks_impl == sha256_blocks_sw ? "software" : "sha-ni";
+}
+
+static inline void sha256_init(sha256_ctx *s) {
+    static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    pthread_once(&sha256_once, sha256_pick);
+    memcpy(s->h, iv, sizeof(iv));
+    s->len = 0; s->n = 0;
+}
+
+static inline void sha256_update(sha256_ctx *s, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    s->len += len;
+    if (s->n > 0) {
+        size_t take = 64 - s->n < len ? 64 - s->n : len;
+        memcpy(s->buf + s->n, p, take);
+        s->n += take; p += take; len -= take;
+        if (s->n < 64) return;
+        sha256_blocks_impl(s->h, s->buf, 1);
+        s->n = 0;
+    }
+    if (len >= 64) {
+        sha256_blocks_impl(s->h, p, len / 64);
+        p += len & ~(size_t)63; len &= 63;
+    }
+    memcpy(s->buf, p, len);
+    s->n = len;
+}
+
+static inline void sha256_final(sha256_ctx *s, unsigned char out[32]) {
+    uint64_t bits = s->len * 8;
+    s->buf[s->n++] = 0x80;
+    if (s->n > 56) {
+        memset(s->buf + s->n, 0, 64 - s->n);
+        sha256_blocks_impl(s->h, s->buf, 1);
+        s->n = 0;
+    }
+    memset(s->buf + s->n, 0, 56 - s->n);
+    for (int i = 0; i < 8; i++) s->buf[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_blocks_impl(s->h, s->buf, 1);
+    for (int i = 0; i < 8; i++) {
+        out[4*i] = (unsigned char)(s->h[i] >> 24); out[4*i+1] = (unsigned char)(s->h[i] >> 16);
+        out[4*i+2] = (unsigned char)(s->h[i] >> 8); out[4*i+3] = (unsigned char)s->h[i];
+    }
+}
+
+static inline void sha256_hex(const unsigned char d[32], char hex[65]) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 32; i++) { hex[2*i] = digits[d[i] >> 4]; hex[2*i+1] = digits[d[i] & 15]; }
+    hex[64] = '\0';
+}
+
+#endif
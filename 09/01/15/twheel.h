@@ -0,0 +1,103 @@
+// twheel.h
+// Rueda de temporizadores jerárquica (estilo del kernel): armar y cancelar en O(1), y
+// avanzar cuesta lo que haya en la ranura del tick (más un reparto ocasional de un nivel).
+// - TW_LEVELS niveles de TW_SIZE ranuras; el nivel n cubre hasta TW_SIZE^(n+1) ticks.
+//   Con 4 niveles de 64 y ticks de 100 ms llega a ~19 días; más lejos se recorta al máximo.
+// - El temporizador va dentro de la estructura de su dueño (sin reservas): el callback
+//   recupera al dueño con offsetof.
+// - Sin cerrojos: cada rueda es de un solo hilo (un worker epoll).
+// - Uso: tw_init(&w, ahora); tw_arm(&w, &t, vence); tw_cancel(&w, &t);
+//        tw_advance(&w, ahora, cb, arg) llama a cb(t, arg) para cada vencido, ya desarmado
+//        (cb puede volver a armarlo o liberar a su dueño).
+
+#ifndef TWHEEL_H
+#define TWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+
+typedef struct tw_timer {
+    struct tw_timer *next, **pprev;    // pprev == NULL: desarmado
+    uint64_t expires;                  // tick absoluto
+} tw_timer;
+
+typedef struct {
+    uint64_t now;                      // último tick procesado
+    size_t armed;
+    tw_timer *slot[TW_LEVELS][TW_SIZE];
+} twheel;
+
+static inline void tw_init(twheel *w, uint64_t now) {
+    for (int l = 0; l < TW_LEVELS; l++)
+        for (int i = 0; i < TW_SIZE; i++) w->slot[l][i] = NULL;
+    w->now = now;
+    w->armed = 0;
+}
+
+static inline bool tw_armed(const tw_timer *t) { return t->pprev != NULL; }
+
+static inline void tw_link(twheel *w, tw_timer *t) {
+    uint64_t delta = t->expires - w->now;
+    int l = 0;
+    while (l < TW_LEVELS - 1 && delta >= ((uint64_t)1 << (TW_BITS * (l + 1)))) l++;
+    if (l == TW_LEVELS - 1 && delta >= ((uint64_t)1 << (TW_BITS * TW_LEVELS)))
+        t->expires = w->now + ((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1;   // más allá del último nivel
+    tw_timer **head = &w->slot[l][(t->expires >> (TW_BITS * l)) & TW_MASK];
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static inline void tw_cancel(twheel *w, tw_timer *t) {
+    if (!t->pprev) return;
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL; t->pprev = NULL;
+    w->armed--;
+}
+
+// Vence en el tick expires (si ya pasó, en el siguiente). Rearmar uno armado lo mueve.
+static inline void tw_arm(twheel *w, tw_timer *t, uint64_t expires) {
+    tw_cancel(w, t);
+    t->expires = expires > w->now ? expires : w->now + 1;
+    tw_link(w, t);
+    w->armed++;
+}
+
+// Baja al nivel que les toque los temporizadores de una ranura de nivel superior.
+static inline void tw_cascade(twheel *w, int l, int idx) {
+    tw_timer *t = w->slot[l][idx];
+    w->slot[l][idx] = NULL;
+    while (t) {
+        tw_timer *next = t->next;
+        tw_link(w, t);
+        t = next;
+    }
+}
+
+static inline void tw_advance(twheel *w, uint64_t now, void (*fire)(tw_timer *, void *), void *arg) {
+    if (w->armed == 0) { if (now > w->now) w->now = now; return; }
+    while (w->now < now) {
+        w->now++;
+        for (int l = 1; l < TW_LEVELS; l++) {
+            if ((w->now & (((uint64_t)1 << (TW_BITS * l)) - 1)) != 0) break;
+            tw_cascade(w, l, (int)((w->now >> (TW_BITS * l)) & TW_MASK));
+        }
+        tw_timer **head = &w->slot[0][w->now & TW_MASK];
+        while (*head) {
+            tw_timer *t = *head;
+            tw_cancel(w, t);
+            fire(t, arg);
+        }
+        if (w->armed == 0) { w->now = now; return; }
+    }
+}
+
+#endif
@@ -0,0 +1,251 @@
+// uring.h
+// io_uring sin liburing: lo justo para server.c, con las llamadas al sistema directas.
+// - uring_init() crea el anillo y mapea SQ, CQ y SQEs (una sola región si el kernel lo admite).
+// - uring_sqe() da la siguiente SQE a rellenar; todas las rellenadas salen juntas en el
+//   siguiente uring_wait(), que además espera completions (con plazo, IORING_ENTER_EXT_ARG).
+// - Anillo de buffers provistos (IORING_REGISTER_PBUF_RING): el kernel elige el buffer de
+//   cada recv al llegar los datos y lo indica en la CQE; se devuelven en cualquier orden.
+// - Sin cerrojos: un anillo por hilo.
+// - Uso: uring u; uring_init(&u, 4096, 0);
+//        s = uring_sqe(&u); uring_prep(s, IORING_OP_RECV, fd, buf, len, 0, dato); ...
+//        uring_wait(&u, ms); while ((cqe = uring_cqe(&u))) { ...; uring_cqe_seen(&u); }
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+typedef struct {
+    int fd;
+    unsigned features;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local;             // siguiente SQE a rellenar (se publica en sq_tail al enviar)
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz;
+    unsigned long long enters, completions;     // para comparar llamadas con operaciones
+} uring;
+
+// Anillo de buffers provistos: count buffers de size bytes, del grupo bgid.
+typedef struct {
+    struct io_uring_buf_ring *br;
+    char *base;
+    unsigned count, size;
+    unsigned short bgid, tail;
+    unsigned out;                  // entregados por el kernel y aún no devueltos
+} uring_bufs;
+
+#define URING_LOAD(p)     atomic_load_explicit((_Atomic __typeof__(*(p))*)(p), memory_order_acquire)
+#define URING_STORE(p, v) atomic_store_explicit((_Atomic __typeof__(*(p))*)(p), (v), memory_order_release)
+
+static inline int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+static inline int uring_register(int fd, unsigned op, void *arg, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static inline void uring_exit(uring *u) {
+    if (u->sqes) munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+    if (u->cq_ring && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_sz);
+    if (u->sq_ring) munmap(u->sq_ring, u->sq_ring_sz);
+    if (u->fd >= 0) close(u->fd);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+// entries SQEs y el doble de CQEs. Si el kernel no admite flags, se reintenta sin ellos.
+// 0 o -errno.
+static inline int uring_init(uring *u, unsigned entries, unsigned flags) {
+    struct io_uring_params p;
+    memset(u, 0, sizeof(*u));
+    for (;;) {
+        memset(&p, 0, sizeof(p));
+        p.flags = flags | IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 2;
+        u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (u->fd >= 0) break;
+        if (errno != EINVAL || flags == 0) { int e = errno; u->fd = -1; return -e; }
+        flags = 0;
+    }
+    u->features = p.features;
+    u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_sz > u->sq_ring_sz) u->sq_ring_sz = u->cq_ring_sz;
+        u->cq_ring_sz = u->sq_ring_sz;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) { u->sq_ring = NULL; goto fail; }
+    u->cq_ring = u->sq_ring;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) { u->cq_ring = NULL; goto fail; }
+    }
+    u->sq_entries = p.sq_entries;
+    u->sqes = (struct io_uring_sqe*)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) { u->sqes = NULL; goto fail; }
+    char *sq = (char*)u->sq_ring, *cq = (char*)u->cq_ring;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    for (unsigned i = 0; i < p.sq_entries; i++) u->sq_array[i] = i;    // SQE i en la posición i
+    u->sq_local = *u->sq_tail;
+    return 0;
+fail:;
+    int e = errno;
+    uring_exit(u);
+    return -e;
+}
+
+static inline unsigned uring_pending(const uring *u) { return u->sq_local - URING_LOAD(u->sq_head); }
+
+// Envía lo rellenado sin esperar. Devuelve las SQEs que tomó el kernel o -errno.
+static inline int uring_submit(uring *u) {
+    URING_STORE(u->sq_tail, u->sq_local);
+    unsigned n = uring_pending(u);
+    if (!n) return 0;
+    u->enters++;
+    int r = uring_enter(u->fd, n, 0, 0, NULL, 0);
+    return r < 0 ? -errno : r;
+}
+
+// Envía lo rellenado y espera al menos una completion, o timeout_ms (-1: sin plazo).
+static inline int uring_wait(uring *u, int timeout_ms) {
+    URING_STORE(u->sq_tail, u->sq_local);
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    void *a = NULL; size_t asz = 0;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        a = &arg; asz = sizeof(arg);
+    }
+    u->enters++;
+    int r = uring_enter(u->fd, uring_pending(u), 1, flags, a, asz);
+    return r < 0 ? -errno : r;
+}
+
+// Siguiente SQE (a cero) o NULL si la cola sigue llena tras enviar lo que había.
+static inline struct io_uring_sqe *uring_sqe(uring *u) {
+    if (u->sq_local - URING_LOAD(u->sq_head) >= u->sq_entries) {
+        uring_submit(u);
+        if (u->sq_local - URING_LOAD(u->sq_head) >= u->sq_entries) return NULL;
+    }
+    struct io_uring_sqe *s = &u->sqes[u->sq_local & *u->sq_mask];
+    memset(s, 0, sizeof(*s));
+    u->sq_local++;
+    return s;
+}
+
+// Garantiza n SQEs libres seguidas: una cadena enlazada no debe partirse en dos envíos.
+static inline bool uring_room(uring *u, unsigned n) {
+    if (u->sq_local - URING_LOAD(u->sq_head) + n > u->sq_entries) uring_submit(u);
+    return u->sq_local - URING_LOAD(u->sq_head) + n <= u->sq_entries;
+}
+
+static inline void uring_prep(struct io_uring_sqe *s, int op, int fd, const void *addr, unsigned len,
+                              uint64_t off, uint64_t data) {
+    s->opcode = (uint8_t)op;
+    s->fd = fd;
+    s->addr = (uint64_t)(uintptr_t)addr;
+    s->len = len;
+    s->off = off;
+    s->user_data = data;
+}
+
+// Siguiente CQE sin consumir, o NULL. Copiar lo que haga falta antes de uring_cqe_seen().
+static inline struct io_uring_cqe *uring_cqe(uring *u) {
+    unsigned head = *u->cq_head;
+    if (head == URING_LOAD(u->cq_tail)) return NULL;
+    return &u->cqes[head & *u->cq_mask];
+}
+static inline void uring_cqe_seen(uring *u) {
+    URING_STORE(u->cq_head, *u->cq_head + 1);
+    u->completions++;
+}
+
+// Cancela la operación con ese user_data y espera a que termine. 0 o -errno (-ENOENT si
+// ya había terminado: su CQE está o estará en la cola).
+// Solo para operaciones que esperan en poll (accept, recv, POLL_ADD), que se cancelan en el
+// acto: con IORING_SETUP_DEFER_TASKRUN la CQE de una que está en los hilos del kernel (un
+// splice con un pipe bloqueante) queda en el trabajo diferido del anillo, que nadie corre
+// mientras se espera aquí, y la llamada no vuelve nunca. Para esas, uring_cancel().
+static inline int uring_cancel_sync(uring *u, uint64_t data) {
+    struct io_uring_sync_cancel_reg r;
+    memset(&r, 0, sizeof(r));
+    r.addr = data;
+    r.fd = -1;
+    r.timeout.tv_sec = -1; r.timeout.tv_nsec = -1;
+    return uring_register(u->fd, IORING_REGISTER_SYNC_CANCEL, &r, 1) < 0 ? -errno : 0;
+}
+
+// Pide cancelar la operación con ese user_data sin esperar: vuelve con su CQE (-ECANCELED o
+// -EINTR) y la de la cancelación lleva tag. false si no quedaba SQE libre.
+static inline bool uring_cancel(uring *u, uint64_t data, uint64_t tag) {
+    struct io_uring_sqe *s = uring_sqe(u);
+    if (!s) return false;
+    uring_prep(s, IORING_OP_ASYNC_CANCEL, -1, (const void*)(uintptr_t)data, 0, 0, tag);
+    return true;
+}
+
+static inline char *uring_buf(const uring_bufs *b, unsigned bid) { return b->base + (size_t)bid * b->size; }
+
+// Buffer que trae una CQE con IORING_CQE_F_BUFFER: es del usuario hasta uring_buf_put().
+static inline unsigned uring_buf_id(uring_bufs *b, unsigned cqe_flags) {
+    b->out++;
+    return cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+}
+
+// Devuelve el buffer bid al kernel.
+static inline void uring_buf_put(uring_bufs *b, unsigned bid) {
+    b->out--;
+    struct io_uring_buf *e = &b->br->bufs[b->tail & (b->count - 1)];
+    e->addr = (uint64_t)(uintptr_t)uring_buf(b, bid);
+    e->len = b->size;
+    e->bid = (unsigned short)bid;
+    b->tail++;
+    URING_STORE(&b->br->tail, b->tail);
+}
+
+// count potencia de 2 (máximo 32768). 0 o -errno.
+static inline int uring_bufs_init(uring *u, uring_bufs *b, unsigned short bgid, unsigned count, unsigned size) {
+    memset(b, 0, sizeof(*b));
+    b->count = count; b->size = size; b->bgid = bgid;
+    b->br = (struct io_uring_buf_ring*)mmap(NULL, count * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    b->base = (char*)mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->br == MAP_FAILED || b->base == MAP_FAILED) return -ENOMEM;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)b->br;
+    reg.ring_entries = count;
+    reg.bgid = bgid;
+    if (uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -errno;
+    b->out = count;
+    for (unsigned i = 0; i < count; i++) uring_buf_put(b, i);
+    return 0;
+}
+
+#endif